@@ -141,12 +141,11 @@ graph_t* NewGraphAdapter::BuildGraph(TSet<UEdGraphNode*> Nodes, bool IsParameter
 
 TMap<UEdGraphNode*, FSlateRect> NewGraphAdapter::GetBoundMap(graph_layout::graph_t* Graph)
 {
-    auto Bounds = Graph->get_bounds();
     TMap<UEdGraphNode*, FSlateRect> Result;
-    for (auto [Node, Rect] : Bounds)
+    Graph->visit_bounds([&Result](node_t* Node, const rect_t& Rect)
     {
         Result.Add((UEdGraphNode*) Node->user_ptr, FSlateRect(Rect.l, Rect.t, Rect.r, Rect.b));
-    }
+    });
     return Result;
 }
 
@@ -0,0 +1,631 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Howaajin. All rights reserved.
+ *  Licensed under the MIT License. See License in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+
+#include "graph_file.h"
+
+#include <cassert>
+#include <cstring>
+#include <fstream>
+#include <unordered_map>
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace graph_layout
+{
+    using namespace std;
+
+    static_assert(sizeof(graph_file_header_t) == 14 * 4, "graph_file_header_t must be packed");
+    static_assert(sizeof(graph_record_t) == 22 * 4, "graph_record_t must be packed");
+    static_assert(sizeof(node_record_t) == 12 * 4, "node_record_t must be packed");
+    static_assert(sizeof(pin_record_t) == 4 * 4, "pin_record_t must be packed");
+    static_assert(sizeof(edge_record_t) == 4 * 4, "edge_record_t must be packed");
+
+    mapped_file_t::~mapped_file_t()
+    {
+        close();
+    }
+
+#if defined(_WIN32)
+    bool mapped_file_t::open(const std::string& path)
+    {
+        close();
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            return false;
+        }
+        LARGE_INTEGER file_size;
+        if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0)
+        {
+            CloseHandle(file);
+            return false;
+        }
+        HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        CloseHandle(file);
+        if (mapping == nullptr)
+        {
+            return false;
+        }
+        const void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        if (view == nullptr)
+        {
+            CloseHandle(mapping);
+            return false;
+        }
+        handle = mapping;
+        data = static_cast<const uint8_t*>(view);
+        size = static_cast<size_t>(file_size.QuadPart);
+        return true;
+    }
+
+    void mapped_file_t::close()
+    {
+        if (data)
+        {
+            UnmapViewOfFile(data);
+            CloseHandle(static_cast<HANDLE>(handle));
+        }
+        data = nullptr;
+        size = 0;
+        handle = nullptr;
+    }
+#else
+    bool mapped_file_t::open(const std::string& path)
+    {
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return false;
+        }
+        struct stat st{};
+        if (fstat(fd, &st) != 0 || st.st_size == 0)
+        {
+            ::close(fd);
+            return false;
+        }
+        void* view = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (view == MAP_FAILED)
+        {
+            return false;
+        }
+        data = static_cast<const uint8_t*>(view);
+        size = static_cast<size_t>(st.st_size);
+        return true;
+    }
+
+    void mapped_file_t::close()
+    {
+        if (data)
+        {
+            munmap(const_cast<uint8_t*>(data), size);
+        }
+        data = nullptr;
+        size = 0;
+        handle = nullptr;
+    }
+#endif
+
+    static bool is_section_valid(size_t file_size, uint32_t offset, uint32_t count, size_t record_size)
+    {
+        if (offset % 4 != 0 || offset > file_size)
+        {
+            return false;
+        }
+        return static_cast<uint64_t>(count) * record_size <= file_size - offset;
+    }
+
+    bool graph_file_view_t::open(const void* data, size_t size)
+    {
+        header = nullptr;
+        if (data == nullptr || size < sizeof(graph_file_header_t) || reinterpret_cast<uintptr_t>(data) % 4 != 0)
+        {
+            return false;
+        }
+        auto bytes = static_cast<const uint8_t*>(data);
+        auto h = reinterpret_cast<const graph_file_header_t*>(bytes);
+        if (h->magic != graph_file_magic || h->version != graph_file_version || h->header_size != sizeof(graph_file_header_t) || h->graph_count == 0)
+        {
+            return false;
+        }
+        if (!is_section_valid(size, h->graphs_offset, h->graph_count, sizeof(graph_record_t)) ||
+            !is_section_valid(size, h->nodes_offset, h->node_count, sizeof(node_record_t)) ||
+            !is_section_valid(size, h->pins_offset, h->pin_count, sizeof(pin_record_t)) ||
+            !is_section_valid(size, h->edges_offset, h->edge_count, sizeof(edge_record_t)) ||
+            !is_section_valid(size, h->strings_offset, h->string_bytes, 1))
+        {
+            return false;
+        }
+        header = h;
+        graphs = reinterpret_cast<const graph_record_t*>(bytes + h->graphs_offset);
+        nodes = reinterpret_cast<const node_record_t*>(bytes + h->nodes_offset);
+        pins = reinterpret_cast<const pin_record_t*>(bytes + h->pins_offset);
+        edges = reinterpret_cast<const edge_record_t*>(bytes + h->edges_offset);
+        strings = reinterpret_cast<const char*>(bytes + h->strings_offset);
+        return true;
+    }
+
+    std::string graph_file_view_t::node_name(const node_record_t& node) const
+    {
+        if (static_cast<uint64_t>(node.name_offset) + node.name_length > header->string_bytes)
+        {
+            return {};
+        }
+        return string(strings + node.name_offset, node.name_length);
+    }
+
+    graph_t* graph_file_view_t::load(graph_file_index_t* index) const
+    {
+        if (header == nullptr)
+        {
+            return nullptr;
+        }
+        const auto graph_count = header->graph_count;
+        const auto node_count = header->node_count;
+        const auto pin_count = header->pin_count;
+        const auto edge_count = header->edge_count;
+        auto in_range = [](uint32_t first, uint32_t count, uint32_t total)
+        {
+            return first <= total && count <= total - first;
+        };
+        // Every graph except the root must be owned exactly once, either by a disconnected graph or by a node.
+        vector<uint32_t> owners(graph_count, 0);
+        vector<uint32_t> pin_graph(pin_count, graph_count);
+        for (uint32_t i = 0; i < graph_count; i++)
+        {
+            const auto& g = graphs[i];
+            if (g.kind != graph_kind_t::connected && g.kind != graph_kind_t::disconnected)
+            {
+                return nullptr;
+            }
+            if (!in_range(g.first_child, g.child_count, graph_count) || (g.child_count != 0 && g.first_child <= i) ||
+                !in_range(g.first_node, g.node_count, node_count) || !in_range(g.first_edge, g.edge_count, edge_count))
+            {
+                return nullptr;
+            }
+            if (g.kind == graph_kind_t::disconnected)
+            {
+                for (uint32_t c = g.first_child; c < g.first_child + g.child_count; c++)
+                {
+                    owners[c]++;
+                }
+                continue;
+            }
+            // Rank slot nodes are -1 or one of the graph's own nodes.
+            auto is_own_node = [&g](int32_t k)
+            {
+                return k == -1 || (k >= 0 && static_cast<uint32_t>(k) >= g.first_node && static_cast<uint32_t>(k) - g.first_node < g.node_count);
+            };
+            if (!is_own_node(g.min_ranking_node) || !is_own_node(g.max_ranking_node))
+            {
+                return nullptr;
+            }
+            for (uint32_t k = g.first_node; k < g.first_node + g.node_count; k++)
+            {
+                const auto& n = nodes[k];
+                if (!in_range(n.first_pin, n.in_pin_count, pin_count) || !in_range(n.first_pin + n.in_pin_count, n.out_pin_count, pin_count))
+                {
+                    return nullptr;
+                }
+                if (n.sub_graph == 0 || n.sub_graph >= static_cast<int32_t>(graph_count) || (n.sub_graph > 0 && static_cast<uint32_t>(n.sub_graph) <= i))
+                {
+                    return nullptr;
+                }
+                if (n.sub_graph > 0)
+                {
+                    owners[n.sub_graph]++;
+                }
+                for (uint32_t p = n.first_pin; p < n.first_pin + n.in_pin_count + n.out_pin_count; p++)
+                {
+                    const auto type = p < n.first_pin + n.in_pin_count ? pin_type_t::in : pin_type_t::out;
+                    if (pin_graph[p] != graph_count || pins[p].type != type)
+                    {
+                        return nullptr;
+                    }
+                    pin_graph[p] = i;
+                }
+            }
+            for (uint32_t k = g.first_edge; k < g.first_edge + g.edge_count; k++)
+            {
+                const auto& e = edges[k];
+                if (e.tail >= pin_count || e.head >= pin_count || pin_graph[e.tail] != i || pin_graph[e.head] != i)
+                {
+                    return nullptr;
+                }
+                if (pins[e.tail].type != pin_type_t::out || pins[e.head].type != pin_type_t::in)
+                {
+                    return nullptr;
+                }
+            }
+        }
+        for (uint32_t i = 1; i < graph_count; i++)
+        {
+            if (owners[i] != 1)
+            {
+                return nullptr;
+            }
+        }
+
+        vector<graph_t*> graph_table(graph_count, nullptr);
+        vector<node_t*> node_table(node_count, nullptr);
+        vector<pin_t*> pin_table(pin_count, nullptr);
+        for (uint32_t i = 0; i < graph_count; i++)
+        {
+            const auto& record = graphs[i];
+            graph_t* g;
+            if (record.kind == graph_kind_t::connected)
+            {
+                auto connected = new connected_graph_t;
+                connected->max_iterations = record.max_iterations;
+                g = connected;
+            }
+            else
+            {
+                g = new disconnected_graph_t;
+            }
+            g->spacing = record.spacing;
+            g->border = record.border;
+            g->bound = record.bound;
+            g->is_vertical_layout = record.is_vertical_layout != 0;
+            graph_table[i] = g;
+        }
+
+        for (uint32_t i = 0; i < graph_count; i++)
+        {
+            const auto& record = graphs[i];
+            graph_t* g = graph_table[i];
+            if (record.kind == graph_kind_t::disconnected)
+            {
+                auto disconnected = static_cast<disconnected_graph_t*>(g);
+                for (uint32_t c = 0; c < record.child_count; c++)
+                {
+                    disconnected->add_graph(graph_table[record.first_child + c]);
+                }
+                continue;
+            }
+            g->nodes.reserve(record.node_count);
+            for (uint32_t k = record.first_node; k < record.first_node + record.node_count; k++)
+            {
+                const auto& node_record = nodes[k];
+                graph_t* sub_graph = node_record.sub_graph > 0 ? graph_table[node_record.sub_graph] : nullptr;
+                node_t* node = g->add_node(node_name(node_record), sub_graph);
+                node->size = node_record.size;
+                node->position = node_record.position;
+                node->rank = node_record.rank;
+                node->is_dummy_node = (node_record.flags & node_record_dummy) != 0;
+                node->in_pins.reserve(node_record.in_pin_count);
+                node->out_pins.reserve(node_record.out_pin_count);
+                const uint32_t out_pin_start = node_record.first_pin + node_record.in_pin_count;
+                const uint32_t pin_end = out_pin_start + node_record.out_pin_count;
+                for (uint32_t p = node_record.first_pin; p < pin_end; p++)
+                {
+                    const auto& pin_record = pins[p];
+                    auto pin = new pin_t{pin_record.type, pin_record.offset, node};
+                    pin->id = p - node_record.first_pin;
+                    (p < out_pin_start ? node->in_pins : node->out_pins).push_back(pin);
+                    pin_table[p] = pin;
+                }
+                node_table[k] = node;
+            }
+            for (uint32_t k = record.first_edge; k < record.first_edge + record.edge_count; k++)
+            {
+                const auto& edge_record = edges[k];
+                edge_t* edge = g->add_edge(pin_table[edge_record.tail], pin_table[edge_record.head]);
+                edge->weight = edge_record.weight;
+                edge->min_length = edge_record.min_length;
+            }
+            auto connected = static_cast<connected_graph_t*>(g);
+            auto node_at = [&](int32_t k) -> node_t*
+            {
+                return k >= 0 ? node_table[k] : nullptr;
+            };
+            connected->min_ranking_node = node_at(record.min_ranking_node);
+            connected->max_ranking_node = node_at(record.max_ranking_node);
+        }
+        for (uint32_t p = 0; p < pin_count; p++)
+        {
+            const int32_t copy_from = pins[p].copy_from;
+            if (copy_from >= 0 && pin_table[p])
+            {
+                pin_table[p]->copy_from = copy_from < static_cast<int32_t>(pin_count) ? pin_table[copy_from] : nullptr;
+            }
+        }
+        if (index)
+        {
+            index->graphs = std::move(graph_table);
+            index->nodes = std::move(node_table);
+            return index->graphs[0];
+        }
+        return graph_table[0];
+    }
+
+    std::vector<uint8_t> serialize_graph(const graph_t* graph, bool with_results)
+    {
+        vector<graph_record_t> graph_records;
+        vector<node_record_t> node_records;
+        vector<pin_record_t> pin_records;
+        vector<edge_record_t> edge_records;
+        string string_table;
+        unordered_map<const pin_t*, uint32_t> pin_indices;
+        vector<pair<uint32_t, const pin_t*>> copy_from_fixups;
+
+        vector<const graph_t*> queue{graph};
+        // Offsets that parents of each queued graph haven't handed down yet.
+        vector<vector2_t> inherited_offsets{vector2_t{0, 0}};
+        graph_records.push_back(graph_record_t{});
+        graph_records[0].owner_node = -1;
+        for (size_t i = 0; i < queue.size(); i++)
+        {
+            const graph_t* g = queue[i];
+            const vector2_t inherited_offset = inherited_offsets[i];
+            const vector2_t offset = inherited_offset + g->pending_offset;
+            graph_record_t record{};
+            record.owner_node = graph_records[i].owner_node;
+            record.min_ranking_node = -1;
+            record.max_ranking_node = -1;
+            record.spacing = g->spacing;
+            record.border = g->border;
+            record.bound = g->bound.offset_by(inherited_offset);
+            record.is_vertical_layout = g->is_vertical_layout ? 1 : 0;
+            if (auto disconnected = dynamic_cast<const disconnected_graph_t*>(g))
+            {
+                record.kind = graph_kind_t::disconnected;
+                record.first_child = static_cast<uint32_t>(queue.size());
+                for (auto component : disconnected->get_connected_graphs())
+                {
+                    queue.push_back(component);
+                    inherited_offsets.push_back(offset);
+                    graph_records.push_back(graph_record_t{});
+                    graph_records.back().owner_node = -1;
+                    record.child_count++;
+                }
+                graph_records[i] = record;
+                continue;
+            }
+            record.kind = graph_kind_t::connected;
+            auto connected = dynamic_cast<const connected_graph_t*>(g);
+            record.max_iterations = connected ? static_cast<uint32_t>(connected->max_iterations) : 24;
+            record.first_node = static_cast<uint32_t>(node_records.size());
+            for (auto n : g->nodes)
+            {
+                if (n->is_dummy_node)
+                {
+                    continue;
+                }
+                const auto node_index = static_cast<int32_t>(node_records.size());
+                if (connected && connected->min_ranking_node == n) record.min_ranking_node = node_index;
+                if (connected && connected->max_ranking_node == n) record.max_ranking_node = node_index;
+                node_record_t node_record{};
+                node_record.name_offset = static_cast<uint32_t>(string_table.size());
+                node_record.name_length = static_cast<uint32_t>(n->name.size());
+                string_table += n->name;
+                node_record.first_pin = static_cast<uint32_t>(pin_records.size());
+                node_record.in_pin_count = static_cast<uint32_t>(n->in_pins.size());
+                node_record.out_pin_count = static_cast<uint32_t>(n->out_pins.size());
+                node_record.sub_graph = -1;
+                node_record.rank = n->rank;
+                node_record.size = n->size;
+                node_record.position = n->position + offset;
+                if (n->graph)
+                {
+                    node_record.sub_graph = static_cast<int32_t>(queue.size());
+                    queue.push_back(n->graph);
+                    inherited_offsets.push_back(offset);
+                    graph_records.push_back(graph_record_t{});
+                    graph_records.back().owner_node = node_index;
+                }
+                // Edges are written as they were added, before the layout inverted any, with pins typed by their list.
+                for (auto pins : {&n->in_pins, &n->out_pins})
+                {
+                    for (auto p : *pins)
+                    {
+                        const auto pin_index = static_cast<uint32_t>(pin_records.size());
+                        pin_indices[p] = pin_index;
+                        pin_records.push_back(pin_record_t{pins == &n->in_pins ? pin_type_t::in : pin_type_t::out, -1, p->offset});
+                        if (p->copy_from)
+                        {
+                            copy_from_fixups.emplace_back(pin_index, p->copy_from);
+                        }
+                    }
+                }
+                node_records.push_back(node_record);
+            }
+            record.node_count = static_cast<uint32_t>(node_records.size()) - record.first_node;
+            record.first_edge = static_cast<uint32_t>(edge_records.size());
+            for (auto n : g->nodes)
+            {
+                for (auto e : n->out_edges)
+                {
+                    auto tail = pin_indices.find(e->is_inverted ? e->head : e->tail);
+                    auto head = pin_indices.find(e->is_inverted ? e->tail : e->head);
+                    if (tail == pin_indices.end() || head == pin_indices.end())
+                    {
+                        continue;
+                    }
+                    edge_records.push_back(edge_record_t{tail->second, head->second, e->weight, e->min_length});
+                }
+            }
+            record.edge_count = static_cast<uint32_t>(edge_records.size()) - record.first_edge;
+            graph_records[i] = record;
+        }
+        for (auto [pin_index, copy_from] : copy_from_fixups)
+        {
+            auto it = pin_indices.find(copy_from);
+            if (it != pin_indices.end())
+            {
+                pin_records[pin_index].copy_from = static_cast<int32_t>(it->second);
+            }
+        }
+
+        auto align = [](size_t v) { return (v + 3) & ~static_cast<size_t>(3); };
+        graph_file_header_t header{};
+        header.magic = graph_file_magic;
+        header.version = graph_file_version;
+        header.header_size = sizeof(graph_file_header_t);
+        header.flags = with_results ? static_cast<uint32_t>(graph_file_has_results) : 0u;
+        header.graph_count = static_cast<uint32_t>(graph_records.size());
+        header.node_count = static_cast<uint32_t>(node_records.size());
+        header.pin_count = static_cast<uint32_t>(pin_records.size());
+        header.edge_count = static_cast<uint32_t>(edge_records.size());
+        header.string_bytes = static_cast<uint32_t>(string_table.size());
+        size_t offset = sizeof(graph_file_header_t);
+        header.graphs_offset = static_cast<uint32_t>(offset);
+        offset += graph_records.size() * sizeof(graph_record_t);
+        header.nodes_offset = static_cast<uint32_t>(offset);
+        offset += node_records.size() * sizeof(node_record_t);
+        header.pins_offset = static_cast<uint32_t>(offset);
+        offset += pin_records.size() * sizeof(pin_record_t);
+        header.edges_offset = static_cast<uint32_t>(offset);
+        offset += edge_records.size() * sizeof(edge_record_t);
+        header.strings_offset = static_cast<uint32_t>(offset);
+        offset = align(offset + string_table.size());
+
+        vector<uint8_t> buffer(offset, 0);
+        auto write = [&buffer](uint32_t at, const void* src, size_t bytes)
+        {
+            if (bytes) memcpy(buffer.data() + at, src, bytes);
+        };
+        write(0, &header, sizeof(header));
+        write(header.graphs_offset, graph_records.data(), graph_records.size() * sizeof(graph_record_t));
+        write(header.nodes_offset, node_records.data(), node_records.size() * sizeof(node_record_t));
+        write(header.pins_offset, pin_records.data(), pin_records.size() * sizeof(pin_record_t));
+        write(header.edges_offset, edge_records.data(), edge_records.size() * sizeof(edge_record_t));
+        write(header.strings_offset, string_table.data(), string_table.size());
+        return buffer;
+    }
+
+    bool write_graph_file(const graph_t* graph, const std::string& path, bool with_results)
+    {
+        auto buffer = serialize_graph(graph, with_results);
+        ofstream file(path, ios::binary | ios::trunc);
+        if (!file)
+        {
+            return false;
+        }
+        file.write(reinterpret_cast<const char*>(buffer.data()), static_cast<streamsize>(buffer.size()));
+        return static_cast<bool>(file);
+    }
+
+    bool store_results(const graph_file_index_t& index, void* data, size_t size)
+    {
+        graph_file_view_t view;
+        if (!view.open(data, size) || view.header->graph_count != index.graphs.size() || view.header->node_count != index.nodes.size())
+        {
+            return false;
+        }
+        auto bytes = static_cast<uint8_t*>(data);
+        auto header = reinterpret_cast<graph_file_header_t*>(bytes);
+        auto graphs = reinterpret_cast<graph_record_t*>(bytes + header->graphs_offset);
+        auto nodes = reinterpret_cast<node_record_t*>(bytes + header->nodes_offset);
+        // Graphs are indexed parents first, so each one has received the offsets of its parents when resolved.
+        for (size_t i = 0; i < index.graphs.size(); i++)
+        {
+            index.graphs[i]->resolve_offset();
+            graphs[i].bound = index.graphs[i]->bound;
+        }
+        for (size_t i = 0; i < index.nodes.size(); i++)
+        {
+            nodes[i].position = index.nodes[i]->position;
+            nodes[i].size = index.nodes[i]->size;
+            nodes[i].rank = index.nodes[i]->rank;
+        }
+        header->flags |= graph_file_has_results;
+        return true;
+    }
+
+    void test_graph_file()
+    {
+        // Two components, one holding a node with a sub graph, a rank slot node, a pin copy and a cycle.
+        graph_t input;
+        auto sub = new connected_graph_t;
+        auto sub_a = sub->add_node("sub_a");
+        auto sub_b = sub->add_node("sub_b");
+        sub->add_edge(sub_a->add_pin(pin_type_t::out), sub_b->add_pin(pin_type_t::in));
+        auto a = input.add_node("a");
+        auto b = input.add_node("b", sub);
+        auto c = input.add_node("c");
+        auto d = input.add_node("d");
+        auto e = input.add_node("e");
+        auto a_in = a->add_pin(pin_type_t::in);
+        auto a_out = a->add_pin(pin_type_t::out);
+        auto b_in = b->add_pin(pin_type_t::in);
+        auto b_out = b->add_pin(pin_type_t::out);
+        auto c_in = c->add_pin(pin_type_t::in);
+        auto c_out = c->add_pin(pin_type_t::out);
+        c_in->copy_from = b_in;
+        auto ab = input.add_edge(a_out, b_in);
+        ab->weight = 3;
+        ab->min_length = 2;
+        input.add_edge(b_out, c_in);
+        input.add_edge(c_out, a_in);
+        input.add_edge(d->add_pin(pin_type_t::out), e->add_pin(pin_type_t::in));
+        for (auto n : {a, b, c, d, e, sub_a, sub_b})
+        {
+            n->size = {100, 50};
+        }
+        graph_t* graph = input.to_connected_or_disconnected();
+        auto first = static_cast<connected_graph_t*>(static_cast<disconnected_graph_t*>(graph)->get_connected_graphs()[0]);
+        first->set_node_in_rank_slot(a, rank_slot_t::min);
+
+        const auto bytes = serialize_graph(graph);
+        graph_file_view_t view;
+        assert(view.open(bytes.data(), bytes.size()));
+        graph_file_index_t index;
+        graph_t* loaded = view.load(&index);
+        assert(loaded && index.graphs.size() == 4 && index.nodes.size() == 7);
+        assert(serialize_graph(loaded) == bytes);
+
+        // Results go back into a copy of the input, which still loads after the layout inverted an edge of the cycle.
+        loaded->arrange();
+        vector<uint8_t> results = bytes;
+        assert(store_results(index, results.data(), results.size()));
+        graph_file_view_t results_view;
+        assert(results_view.open(results.data(), results.size()) && results_view.has_results());
+        for (size_t i = 0; i < index.nodes.size(); i++)
+        {
+            assert(results_view.nodes[i].position.x == index.nodes[i]->position.x && results_view.nodes[i].position.y == index.nodes[i]->position.y);
+        }
+        delete results_view.load();
+        delete loaded;
+
+        auto is_rejected = [&bytes](const function<void(uint8_t*, const graph_file_header_t&)>& corrupt)
+        {
+            vector<uint8_t> copy = bytes;
+            const auto header = *reinterpret_cast<const graph_file_header_t*>(copy.data());
+            corrupt(copy.data(), header);
+            graph_file_view_t corrupted;
+            return corrupted.open(copy.data(), copy.size()) && corrupted.load() == nullptr;
+        };
+        assert(is_rejected([](uint8_t* data, const graph_file_header_t& header)
+        {
+            reinterpret_cast<pin_record_t*>(data + header.pins_offset)->type = static_cast<pin_type_t>(7);
+        }));
+        assert(is_rejected([](uint8_t* data, const graph_file_header_t& header)
+        {
+            auto edge = reinterpret_cast<edge_record_t*>(data + header.edges_offset);
+            swap(edge->tail, edge->head);
+        }));
+        assert(is_rejected([](uint8_t* data, const graph_file_header_t& header)
+        {
+            // Graph 1 is the first component, the last node belongs to the sub graph.
+            reinterpret_cast<graph_record_t*>(data + header.graphs_offset)[1].min_ranking_node = static_cast<int32_t>(header.node_count) - 1;
+        }));
+        delete graph;
+    }
+}
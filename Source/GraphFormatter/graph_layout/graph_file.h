@@ -0,0 +1,157 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Howaajin. All rights reserved.
+ *  Licensed under the MIT License. See License in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+
+#pragma once
+
+#include "graph_layout.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace graph_layout
+{
+    // Binary interchange format of graph_layout inputs and results.
+    // Every section is an array of fixed size, 4 bytes aligned, little-endian records,
+    // so a mapped file is used in place and nothing has to be parsed.
+    //
+    // Graph records are stored breadth first, graph 0 is the root. The components of a disconnected
+    // graph and the nodes, pins and edges of a connected graph are contiguous ranges.
+    constexpr uint32_t graph_file_magic = 0x46474C47; // "GLGF"
+    constexpr uint32_t graph_file_version = 1;
+
+    enum class graph_kind_t : uint32_t
+    {
+        connected,
+        disconnected,
+    };
+
+    enum graph_file_flags_t : uint32_t
+    {
+        // Positions and bounds are the result of a layout, not the input.
+        graph_file_has_results = 1 << 0,
+    };
+
+    enum node_record_flags_t : uint32_t
+    {
+        node_record_dummy = 1 << 0,
+    };
+
+    struct graph_file_header_t
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t header_size;
+        uint32_t flags;
+        uint32_t graph_count;
+        uint32_t node_count;
+        uint32_t pin_count;
+        uint32_t edge_count;
+        uint32_t string_bytes;
+        uint32_t graphs_offset;
+        uint32_t nodes_offset;
+        uint32_t pins_offset;
+        uint32_t edges_offset;
+        uint32_t strings_offset;
+    };
+
+    struct graph_record_t
+    {
+        graph_kind_t kind;
+        int32_t owner_node;
+        uint32_t first_child;
+        uint32_t child_count;
+        uint32_t first_node;
+        uint32_t node_count;
+        uint32_t first_edge;
+        uint32_t edge_count;
+        int32_t min_ranking_node;
+        int32_t max_ranking_node;
+        uint32_t is_vertical_layout;
+        uint32_t max_iterations;
+        vector2_t spacing;
+        rect_t border;
+        rect_t bound;
+    };
+
+    struct node_record_t
+    {
+        uint32_t name_offset;
+        uint32_t name_length;
+        uint32_t first_pin;
+        uint32_t in_pin_count;
+        uint32_t out_pin_count;
+        int32_t sub_graph;
+        int32_t rank;
+        uint32_t flags;
+        vector2_t size;
+        vector2_t position;
+    };
+
+    struct pin_record_t
+    {
+        pin_type_t type;
+        int32_t copy_from;
+        vector2_t offset;
+    };
+
+    struct edge_record_t
+    {
+        uint32_t tail;
+        uint32_t head;
+        int32_t weight;
+        int32_t min_length;
+    };
+
+    // Read only memory mapping of a whole file.
+    struct mapped_file_t
+    {
+        mapped_file_t() = default;
+        mapped_file_t(const mapped_file_t&) = delete;
+        mapped_file_t& operator=(const mapped_file_t&) = delete;
+        ~mapped_file_t();
+
+        bool open(const std::string& path);
+        void close();
+
+        const uint8_t* data = nullptr;
+        size_t size = 0;
+
+    private:
+        void* handle = nullptr;
+    };
+
+    // Graphs and nodes created by graph_file_view_t::load(), indexed by their record.
+    struct graph_file_index_t
+    {
+        std::vector<graph_t*> graphs;
+        std::vector<node_t*> nodes;
+    };
+
+    // Validated view of a serialized graph, the records point into the original buffer.
+    struct graph_file_view_t
+    {
+        const graph_file_header_t* header = nullptr;
+        const graph_record_t* graphs = nullptr;
+        const node_record_t* nodes = nullptr;
+        const pin_record_t* pins = nullptr;
+        const edge_record_t* edges = nullptr;
+        const char* strings = nullptr;
+
+        bool open(const void* data, size_t size);
+        bool has_results() const { return header && (header->flags & graph_file_has_results) != 0; }
+        std::string node_name(const node_record_t& node) const;
+        graph_t* load(graph_file_index_t* index = nullptr) const;
+    };
+
+    // Serializes graph and all nested sub graphs. Dummy nodes created by a layout are not written, edges it
+    // inverted are written in their original direction.
+    std::vector<uint8_t> serialize_graph(const graph_t* graph, bool with_results = false);
+    bool write_graph_file(const graph_t* graph, const std::string& path, bool with_results = false);
+    // Overwrites positions and bounds of a serialized graph with those of the loaded graph.
+    bool store_results(const graph_file_index_t& index, void* data, size_t size);
+    // Round trip of every kind of record and rejection of malformed ones, asserts on failure.
+    void test_graph_file();
+}
@@ -0,0 +1,1612 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Howaajin. All rights reserved.
+ *  Licensed under the MIT License. See License in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+
+#include "graph_import.h"
+
+#include "graph_file.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace graph_layout
+{
+    using namespace std;
+
+    namespace
+    {
+        struct import_node_t
+        {
+            string name;
+            vector2_t size;
+            int cluster = -1;
+            // The cluster this entry stands for when edges name a cluster, -1 for plain nodes.
+            int own_cluster = -1;
+            int unit = -1;
+            node_t* node = nullptr;
+            pin_t* in_pin = nullptr;
+            pin_t* out_pin = nullptr;
+        };
+
+        struct import_cluster_t
+        {
+            string name;
+            int parent = -1;
+            int depth = 1;
+            int unit = -1;
+            // Entry in the node table when the cluster has an id edges can refer to, -1 otherwise.
+            int id_node = -1;
+            // The node standing for the cluster in the graph of its parent.
+            node_t* node = nullptr;
+            graph_t* graph = nullptr;
+        };
+
+        struct import_edge_t
+        {
+            int tail;
+            int head;
+            int weight;
+            int min_length;
+        };
+
+        constexpr double max_node_size = 1e6;
+        constexpr double max_edge_value = 1 << 16;
+
+        // Sizes that are not finite or not positive keep the default, larger ones are clamped.
+        float to_node_size(double value, float default_value)
+        {
+            return isfinite(value) && value > 0 ? static_cast<float>(std::min(value, max_node_size)) : default_value;
+        }
+
+        // Weights and minimum lengths are whole numbers, fractions are truncated like GraphViz does and larger
+        // values are clamped. Values that are not finite or negative keep the default.
+        int to_edge_value(double value, int default_value)
+        {
+            return isfinite(value) && value >= 0 ? static_cast<int>(std::min(value, max_edge_value)) : default_value;
+        }
+
+        // The layered layout has no flat edges, lengths under one would put both ends into one layer.
+        int to_min_length(double value, int default_value)
+        {
+            const int length = to_edge_value(value, default_value);
+            return length >= 0 ? std::max(length, 1) : length;
+        }
+
+        // Open addressing table from node names to indices, probing compares the stored hash before touching the name.
+        struct name_table_t
+        {
+            struct slot_t
+            {
+                uint32_t hash;
+                int index;
+            };
+
+            vector<slot_t> slots;
+            size_t count = 0;
+
+            static uint32_t hash_of(const char* text, size_t length)
+            {
+                uint32_t hash = 2166136261u;
+                for (size_t i = 0; i < length; i++)
+                {
+                    hash = (hash ^ static_cast<unsigned char>(text[i])) * 16777619u;
+                }
+                return hash;
+            }
+
+            // Returns the slot of name, an empty slot has index -1.
+            slot_t& find(const string& name, uint32_t hash, const vector<import_node_t>& nodes);
+            void grow(const vector<import_node_t>& nodes);
+        };
+
+        // Collects nodes, clusters and edges while a file is read, then creates the graph hierarchy bottom-up.
+        // Every level is split into connected components, an edge is added to the innermost cluster containing
+        // both ends and reaches nested nodes through proxy pins on the cluster nodes.
+        struct import_builder_t
+        {
+            const graph_import_options_t& options;
+            bool is_vertical_layout;
+            vector<import_node_t> nodes;
+            vector<import_cluster_t> clusters;
+            vector<import_edge_t> edges;
+            name_table_t node_ids;
+            unordered_map<uint64_t, pin_t*> proxy_pins;
+
+            explicit import_builder_t(const graph_import_options_t& options)
+                : options(options), is_vertical_layout(options.is_vertical_layout)
+            {
+            }
+
+            int find_or_add_node(const string& name, bool* is_new = nullptr);
+            int add_cluster(const string& name, int parent);
+            // Lets edges naming the cluster link to the node standing for it.
+            bool set_cluster_id(int cluster, const string& id);
+            void place_node(int node, int cluster);
+            void add_edge(int tail, int head, int weight, int min_length);
+            graph_t* build();
+
+        private:
+            int depth(int cluster) const { return cluster < 0 ? 0 : clusters[cluster].depth; }
+            bool is_ancestor(int ancestor, int cluster) const;
+            int lowest_common_cluster(int a, int b) const;
+            int child_on_path(int level, int cluster) const;
+            pin_t* real_pin(int node, bool is_out);
+            pin_t* proxy_pin(int node, bool is_out, int cluster);
+            pin_t* level_pin(int node, bool is_out, int level);
+            int unit_of(int node, int level) const;
+            graph_t* build_level(int level, const vector<int>& level_nodes, const vector<int>& child_clusters, const vector<int>& level_edges);
+        };
+
+        name_table_t::slot_t& name_table_t::find(const string& name, uint32_t hash, const vector<import_node_t>& nodes)
+        {
+            const size_t mask = slots.size() - 1;
+            for (size_t i = hash & mask;; i = (i + 1) & mask)
+            {
+                auto& slot = slots[i];
+                if (slot.index < 0 || (slot.hash == hash && nodes[slot.index].name == name))
+                {
+                    return slot;
+                }
+            }
+        }
+
+        void name_table_t::grow(const vector<import_node_t>& nodes)
+        {
+            vector<slot_t> old_slots(max<size_t>(slots.size() * 2, 1024), slot_t{0, -1});
+            old_slots.swap(slots);
+            for (const auto& slot : old_slots)
+            {
+                if (slot.index >= 0)
+                {
+                    find(nodes[slot.index].name, slot.hash, nodes) = slot;
+                }
+            }
+        }
+
+        int import_builder_t::find_or_add_node(const string& name, bool* is_new)
+        {
+            // Keep the load factor under one half.
+            if ((node_ids.count + 1) * 2 > node_ids.slots.size())
+            {
+                node_ids.grow(nodes);
+            }
+            const uint32_t hash = name_table_t::hash_of(name.data(), name.size());
+            auto& slot = node_ids.find(name, hash, nodes);
+            if (slot.index >= 0)
+            {
+                if (is_new) *is_new = false;
+                return slot.index;
+            }
+            const int index = static_cast<int>(nodes.size());
+            slot = name_table_t::slot_t{hash, index};
+            node_ids.count++;
+            import_node_t node;
+            node.name = name;
+            node.size = options.default_node_size;
+            nodes.push_back(std::move(node));
+            if (is_new) *is_new = true;
+            return index;
+        }
+
+        int import_builder_t::add_cluster(const string& name, int parent)
+        {
+            import_cluster_t cluster;
+            cluster.name = name;
+            cluster.parent = parent;
+            cluster.depth = depth(parent) + 1;
+            clusters.push_back(std::move(cluster));
+            return static_cast<int>(clusters.size()) - 1;
+        }
+
+        bool import_builder_t::set_cluster_id(int cluster, const string& id)
+        {
+            clusters[cluster].name = id;
+            const int node = find_or_add_node(id);
+            if (nodes[node].own_cluster >= 0)
+            {
+                return false;
+            }
+            nodes[node].own_cluster = cluster;
+            nodes[node].cluster = clusters[cluster].parent;
+            clusters[cluster].id_node = node;
+            return true;
+        }
+
+        bool import_builder_t::is_ancestor(int ancestor, int cluster) const
+        {
+            while (depth(cluster) > depth(ancestor))
+            {
+                cluster = clusters[cluster].parent;
+            }
+            return cluster == ancestor;
+        }
+
+        void import_builder_t::place_node(int node, int cluster)
+        {
+            // A node mentioned in several clusters stays in the innermost one, a cluster stays where it is declared.
+            if (cluster >= 0 && nodes[node].own_cluster < 0 && nodes[node].cluster != cluster && is_ancestor(nodes[node].cluster, cluster))
+            {
+                nodes[node].cluster = cluster;
+            }
+        }
+
+        void import_builder_t::add_edge(int tail, int head, int weight, int min_length)
+        {
+            if (tail != head)
+            {
+                edges.push_back(import_edge_t{tail, head, weight, min_length});
+            }
+        }
+
+        int import_builder_t::lowest_common_cluster(int a, int b) const
+        {
+            while (depth(a) > depth(b)) a = clusters[a].parent;
+            while (depth(b) > depth(a)) b = clusters[b].parent;
+            while (a != b)
+            {
+                a = clusters[a].parent;
+                b = clusters[b].parent;
+            }
+            return a;
+        }
+
+        int import_builder_t::child_on_path(int level, int cluster) const
+        {
+            while (clusters[cluster].parent != level)
+            {
+                cluster = clusters[cluster].parent;
+            }
+            return cluster;
+        }
+
+        pin_t* import_builder_t::real_pin(int node, bool is_out)
+        {
+            auto& n = nodes[node];
+            pin_t*& pin = is_out ? n.out_pin : n.in_pin;
+            if (pin == nullptr)
+            {
+                pin = n.node->add_pin(is_out ? pin_type_t::out : pin_type_t::in);
+                if (is_vertical_layout)
+                {
+                    pin->offset = vector2_t{n.size.x / 2, is_out ? n.size.y : 0};
+                }
+                else
+                {
+                    pin->offset = vector2_t{is_out ? n.size.x : 0, n.size.y / 2};
+                }
+            }
+            return pin;
+        }
+
+        pin_t* import_builder_t::proxy_pin(int node, bool is_out, int cluster)
+        {
+            const uint64_t key = (static_cast<uint64_t>(node) * clusters.size() + cluster) * 2 + (is_out ? 1 : 0);
+            auto it = proxy_pins.find(key);
+            if (it != proxy_pins.end())
+            {
+                return it->second;
+            }
+            const int inner_cluster = nodes[node].cluster;
+            pin_t* inner = inner_cluster == cluster ? real_pin(node, is_out) : proxy_pin(node, is_out, child_on_path(cluster, inner_cluster));
+            pin_t* pin = clusters[cluster].node->add_pin(is_out ? pin_type_t::out : pin_type_t::in);
+            pin->copy_from = inner;
+            proxy_pins.emplace(key, pin);
+            return pin;
+        }
+
+        pin_t* import_builder_t::level_pin(int node, bool is_out, int level)
+        {
+            const int cluster = nodes[node].cluster;
+            if (cluster == level)
+            {
+                return real_pin(node, is_out);
+            }
+            return proxy_pin(node, is_out, child_on_path(level, cluster));
+        }
+
+        int import_builder_t::unit_of(int node, int level) const
+        {
+            const int cluster = nodes[node].cluster;
+            return cluster == level ? nodes[node].unit : clusters[child_on_path(level, cluster)].unit;
+        }
+
+        graph_t* import_builder_t::build()
+        {
+            const size_t level_count = clusters.size() + 1;
+            vector<vector<int>> level_nodes(level_count);
+            vector<vector<int>> child_clusters(level_count);
+            vector<vector<int>> level_edges(level_count);
+            for (size_t i = 0; i < nodes.size(); i++)
+            {
+                if (nodes[i].own_cluster < 0)
+                {
+                    level_nodes[nodes[i].cluster + 1].push_back(static_cast<int>(i));
+                }
+            }
+            for (size_t i = 0; i < clusters.size(); i++)
+            {
+                child_clusters[clusters[i].parent + 1].push_back(static_cast<int>(i));
+            }
+            for (size_t i = 0; i < edges.size(); i++)
+            {
+                const int level = lowest_common_cluster(nodes[edges[i].tail].cluster, nodes[edges[i].head].cluster);
+                level_edges[level + 1].push_back(static_cast<int>(i));
+            }
+            // Clusters are always created after their parent, so walking backwards builds children first.
+            for (int c = static_cast<int>(clusters.size()) - 1; c >= 0; c--)
+            {
+                clusters[c].graph = build_level(c, level_nodes[c + 1], child_clusters[c + 1], level_edges[c + 1]);
+                if (clusters[c].graph)
+                {
+                    clusters[c].graph->border = options.cluster_border;
+                }
+                else if (clusters[c].id_node >= 0)
+                {
+                    // An empty cluster edges refer to is a plain node.
+                    nodes[clusters[c].id_node].own_cluster = -1;
+                    level_nodes[clusters[c].parent + 1].push_back(clusters[c].id_node);
+                }
+            }
+            graph_t* graph = build_level(-1, level_nodes[0], child_clusters[0], level_edges[0]);
+            return graph ? graph : new connected_graph_t;
+        }
+
+        graph_t* import_builder_t::build_level(int level, const vector<int>& level_nodes, const vector<int>& child_clusters, const vector<int>& level_edges)
+        {
+            vector<int> unit_clusters;
+            for (auto c : child_clusters)
+            {
+                if (clusters[c].graph)
+                {
+                    unit_clusters.push_back(c);
+                }
+            }
+            const int unit_count = static_cast<int>(level_nodes.size() + unit_clusters.size());
+            if (unit_count == 0)
+            {
+                return nullptr;
+            }
+            for (size_t i = 0; i < level_nodes.size(); i++)
+            {
+                nodes[level_nodes[i]].unit = static_cast<int>(i);
+            }
+            for (size_t i = 0; i < unit_clusters.size(); i++)
+            {
+                auto& c = clusters[unit_clusters[i]];
+                c.unit = static_cast<int>(level_nodes.size() + i);
+                if (c.id_node >= 0)
+                {
+                    nodes[c.id_node].unit = c.unit;
+                }
+            }
+
+            vector<int> parents(unit_count);
+            for (int i = 0; i < unit_count; i++)
+            {
+                parents[i] = i;
+            }
+            auto find = [&parents](int u)
+            {
+                while (parents[u] != u)
+                {
+                    parents[u] = parents[parents[u]];
+                    u = parents[u];
+                }
+                return u;
+            };
+            // An edge between a cluster and a node inside it doesn't leave the cluster node, it is dropped.
+            auto is_loop = [this, level](const import_edge_t& edge)
+            {
+                return unit_of(edge.tail, level) == unit_of(edge.head, level);
+            };
+            for (auto e : level_edges)
+            {
+                const int a = find(unit_of(edges[e].tail, level));
+                const int b = find(unit_of(edges[e].head, level));
+                if (a != b)
+                {
+                    // The smaller root wins so components keep the order of their first unit.
+                    parents[std::max(a, b)] = std::min(a, b);
+                }
+            }
+
+            vector<connected_graph_t*> unit_graphs(unit_count, nullptr);
+            vector<connected_graph_t*> components;
+            for (int i = 0; i < unit_count; i++)
+            {
+                const int root = find(i);
+                if (unit_graphs[root] == nullptr)
+                {
+                    auto component = new connected_graph_t;
+                    component->is_vertical_layout = is_vertical_layout;
+                    components.push_back(component);
+                    unit_graphs[root] = component;
+                }
+                connected_graph_t* component = unit_graphs[root];
+                unit_graphs[i] = component;
+                if (i < static_cast<int>(level_nodes.size()))
+                {
+                    auto& n = nodes[level_nodes[i]];
+                    n.node = component->add_node(n.name);
+                    n.node->size = n.size;
+                }
+                else
+                {
+                    auto& c = clusters[unit_clusters[i - level_nodes.size()]];
+                    c.node = component->add_node(c.name, c.graph);
+                    if (c.id_node >= 0)
+                    {
+                        nodes[c.id_node].node = c.node;
+                    }
+                }
+            }
+            for (auto e : level_edges)
+            {
+                const auto& edge = edges[e];
+                if (is_loop(edge))
+                {
+                    continue;
+                }
+                connected_graph_t* component = unit_graphs[unit_of(edge.tail, level)];
+                pin_t* tail = level_pin(edge.tail, true, level);
+                pin_t* head = level_pin(edge.head, false, level);
+                const size_t edge_count = component->edges.size();
+                edge_t* added = component->add_edge(tail, head);
+                if (component->edges.size() == edge_count)
+                {
+                    added->weight = static_cast<int>(std::min(static_cast<double>(added->weight) + edge.weight, max_edge_value));
+                    added->min_length = std::max(added->min_length, edge.min_length);
+                }
+                else
+                {
+                    added->weight = edge.weight;
+                    added->min_length = edge.min_length;
+                }
+            }
+
+            if (components.size() == 1)
+            {
+                return components[0];
+            }
+            auto disconnected = new disconnected_graph_t;
+            disconnected->is_vertical_layout = is_vertical_layout;
+            for (auto component : components)
+            {
+                disconnected->add_graph(component);
+            }
+            return disconnected;
+        }
+
+        bool parse_number(const char*& p, const char* end, double& value)
+        {
+            const char* start = p;
+            bool negative = false;
+            if (p < end && (*p == '-' || *p == '+'))
+            {
+                negative = *p == '-';
+                p++;
+            }
+            double result = 0;
+            bool has_digits = false;
+            while (p < end && *p >= '0' && *p <= '9')
+            {
+                result = result * 10 + (*p - '0');
+                has_digits = true;
+                p++;
+            }
+            if (p < end && *p == '.')
+            {
+                p++;
+                double scale = 0.1;
+                while (p < end && *p >= '0' && *p <= '9')
+                {
+                    result += (*p - '0') * scale;
+                    scale *= 0.1;
+                    has_digits = true;
+                    p++;
+                }
+            }
+            if (!has_digits)
+            {
+                p = start;
+                return false;
+            }
+            if (p < end && (*p == 'e' || *p == 'E'))
+            {
+                p++;
+                bool negative_exponent = false;
+                if (p < end && (*p == '-' || *p == '+'))
+                {
+                    negative_exponent = *p == '-';
+                    p++;
+                }
+                int exponent = 0;
+                while (p < end && *p >= '0' && *p <= '9')
+                {
+                    exponent = std::min(exponent * 10 + (*p - '0'), 400);
+                    p++;
+                }
+                for (int i = 0; i < exponent; i++)
+                {
+                    result = negative_exponent ? result / 10 : result * 10;
+                }
+            }
+            value = negative ? -result : result;
+            return true;
+        }
+
+        bool parse_number(const string& text, double& value)
+        {
+            const char* p = text.data();
+            return parse_number(p, text.data() + text.size(), value) && p == text.data() + text.size();
+        }
+
+        bool equals_ignore_case(const string& text, const char* keyword)
+        {
+            size_t i = 0;
+            for (; i < text.size() && keyword[i]; i++)
+            {
+                if (tolower(static_cast<unsigned char>(text[i])) != keyword[i])
+                {
+                    return false;
+                }
+            }
+            return i == text.size() && keyword[i] == 0;
+        }
+
+        struct dot_attributes_t
+        {
+            // In points, the file gives inches.
+            float width = -1;
+            float height = -1;
+            int weight = -1;
+            int min_length = -1;
+        };
+
+        struct dot_parser_t
+        {
+            enum token_t
+            {
+                token_end,
+                token_id,
+                token_left_brace,
+                token_right_brace,
+                token_left_bracket,
+                token_right_bracket,
+                token_semicolon,
+                token_comma,
+                token_equal,
+                token_colon,
+                token_edge_op,
+                token_error,
+            };
+
+            struct scope_t
+            {
+                dot_attributes_t node_defaults;
+                dot_attributes_t edge_defaults;
+                int cluster = -1;
+            };
+
+            const char* p;
+            const char* end;
+            import_builder_t& builder;
+            string error;
+            token_t token = token_end;
+            string text;
+            bool is_quoted = false;
+            vector<scope_t> scopes{scope_t{}};
+
+            dot_parser_t(const char* text, size_t length, import_builder_t& builder)
+                : p(text), end(text + length), builder(builder)
+            {
+            }
+
+            bool is_keyword(const char* keyword) const
+            {
+                return token == token_id && !is_quoted && equals_ignore_case(text, keyword);
+            }
+
+            bool fail(const char* message)
+            {
+                if (error.empty())
+                {
+                    error = message;
+                }
+                token = token_error;
+                return false;
+            }
+
+            void skip_white_space_and_comments();
+            void advance();
+            bool parse_graph();
+            bool parse_stmt_list(vector<int>* mentioned);
+            bool parse_stmt(vector<int>* mentioned);
+            bool parse_operand(vector<int>& operand);
+            bool parse_subgraph(vector<int>& mentioned);
+            bool parse_attributes(dot_attributes_t& attributes, bool is_graph);
+            void apply_graph_attribute(const string& name, const string& value);
+            int node_ref(const string& name, const dot_attributes_t* attributes);
+        };
+
+        void dot_parser_t::skip_white_space_and_comments()
+        {
+            while (p < end)
+            {
+                const char c = *p;
+                if (c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\f' || c == '\v')
+                {
+                    p++;
+                }
+                else if (c == '#' || (c == '/' && p + 1 < end && p[1] == '/'))
+                {
+                    while (p < end && *p != '\n') p++;
+                }
+                else if (c == '/' && p + 1 < end && p[1] == '*')
+                {
+                    p += 2;
+                    while (p + 1 < end && !(p[0] == '*' && p[1] == '/')) p++;
+                    p = p + 1 < end ? p + 2 : end;
+                }
+                else
+                {
+                    break;
+                }
+            }
+        }
+
+        void dot_parser_t::advance()
+        {
+            if (token == token_error)
+            {
+                return;
+            }
+            skip_white_space_and_comments();
+            is_quoted = false;
+            if (p >= end)
+            {
+                token = token_end;
+                return;
+            }
+            const char c = *p;
+            switch (c)
+            {
+            case '{': token = token_left_brace; p++; return;
+            case '}': token = token_right_brace; p++; return;
+            case '[': token = token_left_bracket; p++; return;
+            case ']': token = token_right_bracket; p++; return;
+            case ';': token = token_semicolon; p++; return;
+            case ',': token = token_comma; p++; return;
+            case '=': token = token_equal; p++; return;
+            case ':': token = token_colon; p++; return;
+            default: break;
+            }
+            if (c == '-' && p + 1 < end && (p[1] == '>' || p[1] == '-'))
+            {
+                token = token_edge_op;
+                p += 2;
+                return;
+            }
+            text.clear();
+            if (c == '"')
+            {
+                is_quoted = true;
+                for (;;)
+                {
+                    p++;
+                    while (p < end && *p != '"')
+                    {
+                        if (*p == '\\' && p + 1 < end && (p[1] == '"' || p[1] == '\n' || p[1] == '\r'))
+                        {
+                            if (p[1] == '"') text += '"';
+                            p += 2;
+                            continue;
+                        }
+                        text += *p++;
+                    }
+                    if (p >= end)
+                    {
+                        fail("unterminated string");
+                        return;
+                    }
+                    p++;
+                    // "a" + "b" concatenation.
+                    const char* save = p;
+                    skip_white_space_and_comments();
+                    if (p < end && *p == '+')
+                    {
+                        p++;
+                        skip_white_space_and_comments();
+                        if (p < end && *p == '"')
+                        {
+                            continue;
+                        }
+                    }
+                    p = save;
+                    break;
+                }
+                token = token_id;
+                return;
+            }
+            if (c == '<')
+            {
+                int depth = 0;
+                const char* start = p;
+                while (p < end)
+                {
+                    if (*p == '<') depth++;
+                    else if (*p == '>' && --depth == 0) break;
+                    p++;
+                }
+                if (p >= end)
+                {
+                    fail("unterminated HTML string");
+                    return;
+                }
+                p++;
+                text.assign(start, p);
+                is_quoted = true;
+                token = token_id;
+                return;
+            }
+            const char* start = p;
+            while (p < end)
+            {
+                const auto u = static_cast<unsigned char>(*p);
+                if ((u >= 'a' && u <= 'z') || (u >= 'A' && u <= 'Z') || (u >= '0' && u <= '9') || u == '_' || u == '.' || u >= 0x80 || (u == '-' && p == start))
+                {
+                    p++;
+                }
+                else
+                {
+                    break;
+                }
+            }
+            if (p == start)
+            {
+                fail("unexpected character");
+                return;
+            }
+            text.assign(start, p);
+            token = token_id;
+        }
+
+        bool dot_parser_t::parse_graph()
+        {
+            advance();
+            if (is_keyword("strict"))
+            {
+                advance();
+            }
+            if (!is_keyword("graph") && !is_keyword("digraph"))
+            {
+                return fail("expected graph or digraph");
+            }
+            advance();
+            if (token == token_id)
+            {
+                advance();
+            }
+            if (token != token_left_brace)
+            {
+                return fail("expected {");
+            }
+            advance();
+            if (!parse_stmt_list(nullptr))
+            {
+                return false;
+            }
+            if (token != token_right_brace)
+            {
+                return fail("expected }");
+            }
+            return true;
+        }
+
+        bool dot_parser_t::parse_stmt_list(vector<int>* mentioned)
+        {
+            while (token != token_right_brace && token != token_end)
+            {
+                if (!parse_stmt(mentioned))
+                {
+                    return false;
+                }
+                if (token == token_semicolon)
+                {
+                    advance();
+                }
+            }
+            return token != token_error;
+        }
+
+        bool dot_parser_t::parse_stmt(vector<int>* mentioned)
+        {
+            if (is_keyword("graph") || is_keyword("node") || is_keyword("edge"))
+            {
+                const bool is_graph = is_keyword("graph");
+                const bool is_node = is_keyword("node");
+                advance();
+                auto& defaults = is_node ? scopes.back().node_defaults : scopes.back().edge_defaults;
+                dot_attributes_t attributes = defaults;
+                if (!parse_attributes(attributes, is_graph))
+                {
+                    return false;
+                }
+                if (!is_graph)
+                {
+                    defaults = attributes;
+                }
+                return true;
+            }
+            vector<int> operand;
+            if (token == token_id && !is_keyword("subgraph"))
+            {
+                string name = text;
+                advance();
+                if (token == token_equal)
+                {
+                    advance();
+                    if (token != token_id)
+                    {
+                        return fail("expected attribute value");
+                    }
+                    apply_graph_attribute(name, text);
+                    advance();
+                    return true;
+                }
+                while (token == token_colon)
+                {
+                    advance();
+                    if (token != token_id)
+                    {
+                        return fail("expected port");
+                    }
+                    advance();
+                }
+                if (token != token_edge_op)
+                {
+                    dot_attributes_t attributes;
+                    if (!parse_attributes(attributes, false))
+                    {
+                        return false;
+                    }
+                    const int node = node_ref(name, &attributes);
+                    if (mentioned) mentioned->push_back(node);
+                    return true;
+                }
+                operand.push_back(node_ref(name, nullptr));
+            }
+            else if (!parse_operand(operand))
+            {
+                return false;
+            }
+            if (token != token_edge_op)
+            {
+                if (mentioned) mentioned->insert(mentioned->end(), operand.begin(), operand.end());
+                return true;
+            }
+            vector<vector<int>> chain;
+            chain.push_back(std::move(operand));
+            while (token == token_edge_op)
+            {
+                advance();
+                vector<int> next;
+                if (!parse_operand(next))
+                {
+                    return false;
+                }
+                chain.push_back(std::move(next));
+            }
+            dot_attributes_t attributes = scopes.back().edge_defaults;
+            if (!parse_attributes(attributes, false))
+            {
+                return false;
+            }
+            const int weight = attributes.weight >= 0 ? attributes.weight : 1;
+            const int min_length = attributes.min_length >= 0 ? attributes.min_length : 1;
+            for (size_t i = 1; i < chain.size(); i++)
+            {
+                for (auto tail : chain[i - 1])
+                {
+                    for (auto head : chain[i])
+                    {
+                        builder.add_edge(tail, head, weight, min_length);
+                    }
+                }
+            }
+            if (mentioned)
+            {
+                for (const auto& nodes : chain)
+                {
+                    mentioned->insert(mentioned->end(), nodes.begin(), nodes.end());
+                }
+            }
+            return true;
+        }
+
+        bool dot_parser_t::parse_operand(vector<int>& operand)
+        {
+            if (token == token_left_brace || is_keyword("subgraph"))
+            {
+                return parse_subgraph(operand);
+            }
+            if (token != token_id)
+            {
+                return fail("expected node or subgraph");
+            }
+            operand.push_back(node_ref(text, nullptr));
+            advance();
+            while (token == token_colon)
+            {
+                advance();
+                if (token != token_id)
+                {
+                    return fail("expected port");
+                }
+                advance();
+            }
+            return true;
+        }
+
+        bool dot_parser_t::parse_subgraph(vector<int>& mentioned)
+        {
+            string name;
+            if (is_keyword("subgraph"))
+            {
+                advance();
+                if (token == token_id)
+                {
+                    name = text;
+                    advance();
+                }
+            }
+            if (token != token_left_brace)
+            {
+                return token != token_error;
+            }
+            advance();
+            scope_t scope = scopes.back();
+            if (name.compare(0, 7, "cluster") == 0)
+            {
+                scope.cluster = builder.add_cluster(name, scope.cluster);
+            }
+            scopes.push_back(scope);
+            if (!parse_stmt_list(&mentioned))
+            {
+                return false;
+            }
+            if (token != token_right_brace)
+            {
+                return fail("expected }");
+            }
+            scopes.pop_back();
+            advance();
+            return true;
+        }
+
+        bool dot_parser_t::parse_attributes(dot_attributes_t& attributes, bool is_graph)
+        {
+            while (token == token_left_bracket)
+            {
+                advance();
+                while (token == token_id)
+                {
+                    string name = text;
+                    advance();
+                    if (token != token_equal)
+                    {
+                        return fail("expected =");
+                    }
+                    advance();
+                    if (token != token_id)
+                    {
+                        return fail("expected attribute value");
+                    }
+                    if (is_graph)
+                    {
+                        apply_graph_attribute(name, text);
+                    }
+                    else
+                    {
+                        double value;
+                        if (parse_number(text, value))
+                        {
+                            if (name == "width") attributes.width = to_node_size(value * 72, attributes.width);
+                            else if (name == "height") attributes.height = to_node_size(value * 72, attributes.height);
+                            else if (name == "weight") attributes.weight = to_edge_value(value, attributes.weight);
+                            else if (name == "minlen") attributes.min_length = to_min_length(value, attributes.min_length);
+                        }
+                    }
+                    advance();
+                    if (token == token_comma || token == token_semicolon)
+                    {
+                        advance();
+                    }
+                }
+                if (token != token_right_bracket)
+                {
+                    return fail("expected ]");
+                }
+                advance();
+            }
+            return token != token_error;
+        }
+
+        void dot_parser_t::apply_graph_attribute(const string& name, const string& value)
+        {
+            // Only the root graph decides the direction of the whole layout.
+            if (scopes.size() == 1 && name == "rankdir")
+            {
+                builder.is_vertical_layout = equals_ignore_case(value, "tb") || equals_ignore_case(value, "bt");
+            }
+        }
+
+        int dot_parser_t::node_ref(const string& name, const dot_attributes_t* attributes)
+        {
+            bool is_new;
+            const int node = builder.find_or_add_node(name, &is_new);
+            auto& n = builder.nodes[node];
+            const auto& defaults = scopes.back().node_defaults;
+            if (is_new)
+            {
+                if (defaults.width > 0) n.size.x = defaults.width;
+                if (defaults.height > 0) n.size.y = defaults.height;
+            }
+            if (attributes)
+            {
+                if (attributes->width > 0) n.size.x = attributes->width;
+                if (attributes->height > 0) n.size.y = attributes->height;
+            }
+            builder.place_node(node, scopes.back().cluster);
+            return node;
+        }
+
+        struct json_parser_t
+        {
+            const char* p;
+            const char* end;
+            import_builder_t& builder;
+            string error;
+            string text;
+
+            json_parser_t(const char* text, size_t length, import_builder_t& builder)
+                : p(text), end(text + length), builder(builder)
+            {
+            }
+
+            bool fail(const char* message)
+            {
+                if (error.empty())
+                {
+                    error = message;
+                }
+                return false;
+            }
+
+            void skip_white_space()
+            {
+                while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+                {
+                    p++;
+                }
+            }
+
+            bool consume(char c)
+            {
+                skip_white_space();
+                if (p < end && *p == c)
+                {
+                    p++;
+                    return true;
+                }
+                return false;
+            }
+
+            bool peek(char c)
+            {
+                skip_white_space();
+                return p < end && *p == c;
+            }
+
+            bool parse_string(string& out);
+            bool parse_id(string& out);
+            bool skip_value();
+            bool parse_root();
+            bool parse_nodes(int cluster);
+            bool parse_node(int cluster);
+            bool parse_edges();
+            bool parse_edge();
+            bool parse_ids(vector<int>& ids);
+
+            // Iterates "key": value pairs of an object, on_member consumes the value.
+            template <typename F>
+            bool parse_object(F&& on_member)
+            {
+                if (!consume('{'))
+                {
+                    return fail("expected {");
+                }
+                if (consume('}'))
+                {
+                    return true;
+                }
+                string key;
+                do
+                {
+                    skip_white_space();
+                    if (!parse_string(key) || !consume(':'))
+                    {
+                        return fail("expected member");
+                    }
+                    if (!on_member(key))
+                    {
+                        return false;
+                    }
+                }
+                while (consume(','));
+                return consume('}') || fail("expected }");
+            }
+
+            template <typename F>
+            bool parse_array(F&& on_element)
+            {
+                if (!consume('['))
+                {
+                    return fail("expected [");
+                }
+                if (consume(']'))
+                {
+                    return true;
+                }
+                do
+                {
+                    if (!on_element())
+                    {
+                        return false;
+                    }
+                }
+                while (consume(','));
+                return consume(']') || fail("expected ]");
+            }
+        };
+
+        bool json_parser_t::parse_string(string& out)
+        {
+            if (p >= end || *p != '"')
+            {
+                return fail("expected string");
+            }
+            p++;
+            out.clear();
+            while (p < end && *p != '"')
+            {
+                const char* start = p;
+                while (p < end && *p != '"' && *p != '\\') p++;
+                out.append(start, p);
+                if (p < end && *p == '\\')
+                {
+                    if (p + 1 >= end)
+                    {
+                        return fail("unterminated string");
+                    }
+                    const char c = p[1];
+                    p += 2;
+                    switch (c)
+                    {
+                    case 'b': out += '\b'; break;
+                    case 'f': out += '\f'; break;
+                    case 'n': out += '\n'; break;
+                    case 'r': out += '\r'; break;
+                    case 't': out += '\t'; break;
+                    case 'u':
+                        {
+                            if (end - p < 4)
+                            {
+                                return fail("bad escape");
+                            }
+                            unsigned code = 0;
+                            for (int i = 0; i < 4; i++)
+                            {
+                                const char h = p[i];
+                                code = code * 16 + (h >= '0' && h <= '9' ? h - '0' : (tolower(h) - 'a' + 10) & 0xf);
+                            }
+                            p += 4;
+                            if (code < 0x80)
+                            {
+                                out += static_cast<char>(code);
+                            }
+                            else if (code < 0x800)
+                            {
+                                out += static_cast<char>(0xc0 | (code >> 6));
+                                out += static_cast<char>(0x80 | (code & 0x3f));
+                            }
+                            else
+                            {
+                                out += static_cast<char>(0xe0 | (code >> 12));
+                                out += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+                                out += static_cast<char>(0x80 | (code & 0x3f));
+                            }
+                        }
+                        break;
+                    default: out += c; break;
+                    }
+                }
+            }
+            if (p >= end)
+            {
+                return fail("unterminated string");
+            }
+            p++;
+            return true;
+        }
+
+        bool json_parser_t::parse_id(string& out)
+        {
+            skip_white_space();
+            if (p < end && *p == '"')
+            {
+                return parse_string(out);
+            }
+            const char* start = p;
+            double value;
+            if (!parse_number(p, end, value))
+            {
+                return fail("expected id");
+            }
+            out.assign(start, p);
+            return true;
+        }
+
+        bool json_parser_t::skip_value()
+        {
+            // Iterative so deeply nested unknown members can't overflow the stack.
+            int depth = 0;
+            do
+            {
+                skip_white_space();
+                if (p >= end)
+                {
+                    return fail("unexpected end");
+                }
+                const char c = *p;
+                if (c == '{' || c == '[')
+                {
+                    depth++;
+                    p++;
+                }
+                else if (c == '}' || c == ']')
+                {
+                    depth--;
+                    p++;
+                }
+                else if (c == '"')
+                {
+                    if (!parse_string(text))
+                    {
+                        return false;
+                    }
+                }
+                else if (c == ',' || c == ':')
+                {
+                    if (depth == 0)
+                    {
+                        return fail("unexpected separator");
+                    }
+                    p++;
+                }
+                else
+                {
+                    const char* start = p;
+                    while (p < end && *p != ',' && *p != '}' && *p != ']' && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') p++;
+                    if (p == start)
+                    {
+                        return fail("unexpected character");
+                    }
+                }
+            }
+            while (depth > 0);
+            return depth == 0 || fail("unbalanced value");
+        }
+
+        bool json_parser_t::parse_root()
+        {
+            return parse_object([this](const string& key)
+            {
+                if (key == "nodes" || key == "children")
+                {
+                    return parse_nodes(-1);
+                }
+                if (key == "edges" || key == "links")
+                {
+                    return parse_edges();
+                }
+                return skip_value();
+            });
+        }
+
+        bool json_parser_t::parse_nodes(int cluster)
+        {
+            return parse_array([this, cluster]()
+            {
+                return parse_node(cluster);
+            });
+        }
+
+        bool json_parser_t::parse_node(int cluster)
+        {
+            if (!peek('{'))
+            {
+                // A bare id.
+                string id;
+                if (!parse_id(id))
+                {
+                    return false;
+                }
+                builder.place_node(builder.find_or_add_node(id), cluster);
+                return true;
+            }
+            string id;
+            bool has_id = false;
+            double width = -1, height = -1;
+            int own_cluster = -1;
+            const bool result = parse_object([&](const string& key)
+            {
+                if (key == "id")
+                {
+                    has_id = true;
+                    return parse_id(id);
+                }
+                if (key == "width" || key == "height")
+                {
+                    skip_white_space();
+                    if (!parse_number(p, end, key == "width" ? width : height))
+                    {
+                        return fail("expected number");
+                    }
+                    return true;
+                }
+                if (key == "children")
+                {
+                    if (own_cluster < 0)
+                    {
+                        own_cluster = builder.add_cluster(string(), cluster);
+                    }
+                    return parse_nodes(own_cluster);
+                }
+                if (key == "edges")
+                {
+                    return parse_edges();
+                }
+                return skip_value();
+            });
+            if (!result)
+            {
+                return false;
+            }
+            if (!has_id)
+            {
+                return fail("node without id");
+            }
+            if (own_cluster >= 0)
+            {
+                return builder.set_cluster_id(own_cluster, id) || fail("duplicate cluster id");
+            }
+            const int node = builder.find_or_add_node(id);
+            auto& n = builder.nodes[node];
+            n.size.x = to_node_size(width, n.size.x);
+            n.size.y = to_node_size(height, n.size.y);
+            builder.place_node(node, cluster);
+            return true;
+        }
+
+        bool json_parser_t::parse_edges()
+        {
+            return parse_array([this]()
+            {
+                return parse_edge();
+            });
+        }
+
+        bool json_parser_t::parse_ids(vector<int>& ids)
+        {
+            skip_white_space();
+            if (peek('['))
+            {
+                return parse_array([this, &ids]()
+                {
+                    string id;
+                    if (!parse_id(id))
+                    {
+                        return false;
+                    }
+                    ids.push_back(builder.find_or_add_node(id));
+                    return true;
+                });
+            }
+            string id;
+            if (!parse_id(id))
+            {
+                return false;
+            }
+            ids.push_back(builder.find_or_add_node(id));
+            return true;
+        }
+
+        bool json_parser_t::parse_edge()
+        {
+            vector<int> tails, heads;
+            double weight = 1, min_length = 1;
+            const bool result = parse_object([&](const string& key)
+            {
+                if (key == "source" || key == "sources")
+                {
+                    return parse_ids(tails);
+                }
+                if (key == "target" || key == "targets")
+                {
+                    return parse_ids(heads);
+                }
+                if (key == "weight" || key == "minlen" || key == "min_length")
+                {
+                    skip_white_space();
+                    if (!parse_number(p, end, key == "weight" ? weight : min_length))
+                    {
+                        return fail("expected number");
+                    }
+                    return true;
+                }
+                return skip_value();
+            });
+            if (!result)
+            {
+                return false;
+            }
+            for (auto tail : tails)
+            {
+                for (auto head : heads)
+                {
+                    builder.add_edge(tail, head, to_edge_value(weight, 1), to_min_length(min_length, 1));
+                }
+            }
+            return true;
+        }
+
+        string extension_of(const string& path)
+        {
+            const auto dot = path.find_last_of('.');
+            const auto slash = path.find_last_of("/\\");
+            if (dot == string::npos || (slash != string::npos && dot < slash))
+            {
+                return {};
+            }
+            string extension = path.substr(dot + 1);
+            transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return static_cast<char>(tolower(c)); });
+            return extension;
+        }
+    }
+
+    graph_t* import_dot(const char* text, size_t length, const graph_import_options_t& options, std::string* error)
+    {
+        import_builder_t builder(options);
+        dot_parser_t parser(text, length, builder);
+        if (!parser.parse_graph())
+        {
+            if (error) *error = parser.error;
+            return nullptr;
+        }
+        return builder.build();
+    }
+
+    graph_t* import_json(const char* text, size_t length, const graph_import_options_t& options, std::string* error)
+    {
+        import_builder_t builder(options);
+        json_parser_t parser(text, length, builder);
+        if (!parser.parse_root())
+        {
+            if (error) *error = parser.error;
+            return nullptr;
+        }
+        return builder.build();
+    }
+
+    graph_t* import_graph_file(const std::string& path, const graph_import_options_t& options, std::string* error)
+    {
+        mapped_file_t file;
+        if (!file.open(path))
+        {
+            if (error) *error = "can't open " + path;
+            return nullptr;
+        }
+        const string extension = extension_of(path);
+        const auto text = reinterpret_cast<const char*>(file.data);
+        if (extension == "dot" || extension == "gv")
+        {
+            return import_dot(text, file.size, options, error);
+        }
+        if (extension == "json")
+        {
+            return import_json(text, file.size, options, error);
+        }
+        graph_file_view_t view;
+        graph_t* graph = view.open(file.data, file.size) ? view.load() : nullptr;
+        if (!graph && error)
+        {
+            *error = "invalid graph file " + path;
+        }
+        return graph;
+    }
+
+    void test_graph_import()
+    {
+        auto find_node = [](const graph_t* graph, const string& name)
+        {
+            for (auto n : graph->nodes)
+            {
+                if (n->name == name)
+                {
+                    return n;
+                }
+            }
+            return static_cast<node_t*>(nullptr);
+        };
+        auto count_nodes = [](const graph_t* graph, const string& name)
+        {
+            return count_if(graph->nodes.begin(), graph->nodes.end(), [&name](const node_t* n) { return n->name == name; });
+        };
+
+        // Values the layout can't use fall back or are clamped the same way in both formats.
+        const string dot = "digraph { a [width=1e400]; a -> b [weight=-3, minlen=1e400]; b -> c [weight=1e300, minlen=2.7]; a -> c [minlen=0] }";
+        const string json = R"({"nodes": [{"id": "a", "width": 1e400}, "b", "c"],
+            "edges": [{"source": "a", "target": "b", "weight": -3, "minlen": 1e400}, {"source": "b", "target": "c", "weight": 1e300, "minlen": 2.7},
+                      {"source": "a", "target": "c", "minlen": 0}]})";
+        for (auto graph : {import_dot(dot.data(), dot.size()), import_json(json.data(), json.size())})
+        {
+            assert(graph && graph->nodes.size() == 3 && graph->edges.size() == 3);
+            assert(find_node(graph, "a")->size.x == 50);
+            for (auto [pins, edge] : graph->edges)
+            {
+                const bool is_first = pins.first->owner->name == "a";
+                assert(edge->weight == (is_first ? 1 : static_cast<int>(max_edge_value)));
+                assert(edge->min_length == (is_first ? 1 : 2));
+            }
+            delete graph;
+        }
+
+        // Edges naming a cluster link to its node, the one into its own child is dropped.
+        const string clusters = R"({"nodes": [{"id": "g", "children": ["x", "y"], "edges": [{"source": "x", "target": "y"}]}, "z"],
+            "edges": [{"source": "z", "target": "g"}, {"source": "z", "target": "x"}, {"source": "g", "target": "x"}]})";
+        graph_t* graph = import_json(clusters.data(), clusters.size());
+        assert(graph && graph->nodes.size() == 2 && graph->edges.size() == 2 && count_nodes(graph, "g") == 1);
+        node_t* g = find_node(graph, "g");
+        assert(g->graph && g->in_pins.size() == 2 && count_nodes(g->graph, "x") == 1);
+        graph->arrange();
+        for (auto pin : g->in_pins)
+        {
+            assert(pin->copy_from || (pin->offset.x == 0 && pin->offset.y == g->size.y / 2));
+        }
+        delete graph;
+
+        // An empty cluster edges refer to is a plain node.
+        const string empty = R"({"nodes": [{"id": "e", "children": []}, "f"], "edges": [{"source": "e", "target": "f"}]})";
+        graph = import_json(empty.data(), empty.size());
+        assert(graph && graph->nodes.size() == 2 && graph->edges.size() == 1 && !find_node(graph, "e")->graph);
+        delete graph;
+
+        const string nested = "digraph { subgraph cluster_a { x -> y } z -> x }";
+        graph = import_dot(nested.data(), nested.size());
+        assert(graph && graph->nodes.size() == 2 && graph->edges.size() == 1 && find_node(graph, "cluster_a")->graph);
+        delete graph;
+
+        for (const string invalid : {R"({"nodes": [{"width": 10}]})", R"({"nodes": [{"id": "g", "children": ["a"]}, {"id": "g", "children": ["b"]}]})"})
+        {
+            string error;
+            assert(import_json(invalid.data(), invalid.size(), {}, &error) == nullptr && !error.empty());
+        }
+    }
+}
@@ -0,0 +1,42 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Howaajin. All rights reserved.
+ *  Licensed under the MIT License. See License in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+
+#pragma once
+
+#include "graph_layout.h"
+
+#include <string>
+
+namespace graph_layout
+{
+    struct graph_import_options_t
+    {
+        // Used when a node doesn't specify its size.
+        vector2_t default_node_size{50, 50};
+        // Border of the sub graphs created for clusters.
+        rect_t cluster_border{20, 40, 20, 20};
+        // DOT files override it with the rankdir attribute.
+        bool is_vertical_layout = false;
+    };
+
+    // Imports a GraphViz DOT graph in a single pass over the text.
+    // Clusters (subgraphs named "cluster*") become nodes with sub graphs, other subgraphs only scope attributes.
+    // Node width and height are in inches like GraphViz, weight and minlen are mapped to edge weight and min_length.
+    // In both formats negative or non-finite weights and lengths keep their default and larger values are clamped,
+    // lengths under one are raised to one since the layout has no flat edges.
+    graph_t* import_dot(const char* text, size_t length, const graph_import_options_t& options = {}, std::string* error = nullptr);
+
+    // Imports a JSON graph in a single pass over the text, the common node-link layouts are accepted:
+    // {"nodes"|"children": [{"id", "width", "height", "children": [...], "edges": [...]}],
+    //  "edges"|"links": [{"source"|"sources", "target"|"targets", "weight", "minlen"|"min_length"}]}
+    // A node with children is a cluster, edges naming it link to the cluster node. Every node object needs an id.
+    graph_t* import_json(const char* text, size_t length, const graph_import_options_t& options = {}, std::string* error = nullptr);
+
+    // Maps the file and picks the importer by extension: .dot/.gv, .json or the binary graph file format.
+    graph_t* import_graph_file(const std::string& path, const graph_import_options_t& options = {}, std::string* error = nullptr);
+
+    // Value validation, cluster references and malformed input of both importers, asserts on failure.
+    void test_graph_import();
+}
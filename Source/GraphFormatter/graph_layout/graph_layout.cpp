@@ -4,7 +4,14 @@
  *--------------------------------------------------------------------------------------------*/
 
 #include "graph_layout.h"
+#include "graph_file.h"
+#include "graph_import.h"
+#include "layout_cache.h"
+#include "layout_session.h"
+#include "layout_store.h"
+#include "thread_pool.h"
 
+#include <chrono>
 #include <limits>
 #include <memory>
 #include <algorithm>
@@ -13,18 +20,24 @@
 #include <iostream>
 #include <fstream>
 #include <queue>
+#include <unordered_map>
+#include <unordered_set>
 #include <cmath>
+#include <random>
 
 namespace graph_layout
 {
     using namespace std;
 
+    // Gap left between neighbours in a layer, the spacing of the graph only separates the layers.
+    const vector2_t layer_node_gap{80, 80};
+
     struct fas_positioning_strategy_t
     {
         vector<vector<node_t*>>& layers;
         bool is_horizontal_dir;
         vector<rect_t> layers_bound;
-        vector2_t spacing{80, 80};
+        vector2_t spacing = layer_node_gap;
         bool is_upper_dir = true;
         bool is_left_dir = true;
         map<node_t*, node_t*> conflict_marks{};
@@ -43,6 +56,14 @@ namespace graph_layout
         map<node_t*, float> lower_left_pos_map{};
         map<node_t*, float> lower_right_pos_map{};
         map<node_t*, float> combined_pos_map{};
+        // Shift the class of sink needs to keep clear of the class of neighbour_sink if that one doesn't move.
+        struct class_shift_t
+        {
+            node_t* sink;
+            node_t* neighbour_sink;
+            float shift;
+        };
+        vector<class_shift_t> class_shifts{};
         rect_t assign_coordinate();
 
     private:
@@ -84,6 +105,7 @@ namespace graph_layout
 
         combine();
 
+        vector<vector2_t> positions;
         for (int i = 0; i < layers.size(); i++)
         {
             auto& layer = layers[i];
@@ -124,18 +146,19 @@ namespace graph_layout
                     }
                 }
                 *p_y = (*x_map)[node];
-                node->set_position(vector2_t{x, y});
+                positions.push_back(vector2_t{x, y});
             }
         }
-        const vector2_t position = first_node->position;
-        const vector2_t offset = old_position - position;
-        const auto& bound_pos = first_node->position;
+        // Every node is moved once, the first one keeps its position.
+        const vector2_t offset = old_position - positions[0];
+        const vector2_t bound_pos = old_position;
         rect_t bound{bound_pos.x, bound_pos.y, bound_pos.x, bound_pos.y};
+        size_t index = 0;
         for (auto& layer : layers)
         {
             for (auto node : layer)
             {
-                node->set_position(node->position + offset);
+                node->set_position(positions[index++] + offset);
                 bound = bound.expand(node->position, node->size);
             }
         }
@@ -329,9 +352,8 @@ namespace graph_layout
                     if (sink_map[block_root] != sink_map[prev_block_root])
                     {
                         float left_shift = (*x_map)[block_root] - (*x_map)[prev_block_root] + inner_shift_map[node] - inner_shift_map[adjacency] - adjacency_height - spacing1;
-                        float right_shift = (*x_map)[block_root] - (*x_map)[prev_block_root] - inner_shift_map[node] + inner_shift_map[adjacency] + node_height + spacing1;
-                        float shift = is_left_dir ? std::min(shift_map[sink_map[prev_block_root]], left_shift) : std::max(shift_map[sink_map[prev_block_root]], right_shift);
-                        shift_map[sink_map[prev_block_root]] = shift;
+                        float right_shift = (*x_map)[block_root] - (*x_map)[prev_block_root] + inner_shift_map[node] - inner_shift_map[adjacency] + node_height + spacing1;
+                        class_shifts.push_back(class_shift_t{sink_map[prev_block_root], sink_map[block_root], is_left_dir ? left_shift : right_shift});
                     }
                     else
                     {
@@ -361,6 +383,7 @@ namespace graph_layout
     {
         sink_map.clear();
         shift_map.clear();
+        class_shifts.clear();
         x_map->clear();
         for (auto& layer : layers)
         {
@@ -388,6 +411,28 @@ namespace graph_layout
                 }
             }
         }
+        // A class moves along with the neighbour it keeps clear of, so shifts add up over chains of classes. The
+        // classes don't form a cycle, relaxing settles within one round per class.
+        auto settled_shift = [this](node_t* sink)
+        {
+            const float shift = shift_map[sink];
+            return (is_left_dir && shift < FLT_MAX) || (!is_left_dir && shift > -FLT_MAX) ? shift : 0.0f;
+        };
+        bool is_changed = true;
+        for (size_t round = 0; is_changed && round <= class_shifts.size(); round++)
+        {
+            is_changed = false;
+            for (auto it = class_shifts.rbegin(); it != class_shifts.rend(); ++it)
+            {
+                const float shift = settled_shift(it->neighbour_sink) + it->shift;
+                float& current = shift_map[it->sink];
+                if (is_left_dir ? shift < current : shift > current)
+                {
+                    current = shift;
+                    is_changed = true;
+                }
+            }
+        }
         for (auto& layer : layers)
         {
             for (auto node : layer)
@@ -555,6 +600,29 @@ namespace graph_layout
         return false;
     }
 
+    bool edge_mask_t::is_descendant_of(const node_t* node, const node_t* ancestor) const
+    {
+        unordered_set<const node_t*> visited_set{ancestor};
+        vector<const node_t*> stack{ancestor};
+        while (!stack.empty())
+        {
+            auto n = stack.back();
+            stack.pop_back();
+            if (n == node)
+            {
+                return true;
+            }
+            for (auto e : n->out_edges)
+            {
+                if (!is_masked(e) && visited_set.insert(e->head->owner).second)
+                {
+                    stack.push_back(e->head->owner);
+                }
+            }
+        }
+        return false;
+    }
+
     void node_t::set_position(vector2_t p)
     {
         vector2_t offset = p - position;
@@ -569,6 +637,7 @@ namespace graph_layout
     {
         auto pin = new pin_t{type};
         pin->owner = this;
+        pin->id = in_pins.size() + out_pins.size();
         (type == pin_type_t::in ? in_pins : out_pins).push_back(pin);
         return pin;
     }
@@ -623,9 +692,9 @@ namespace graph_layout
         return sum / static_cast<float>(edges.size());
     }
 
-    set<node_t*> node_t::get_direct_connected_nodes(const function<bool(edge_t*)>& filter) const
+    node_set_t node_t::get_direct_connected_nodes(const function<bool(edge_t*)>& filter) const
     {
-        set<node_t*> result;
+        node_set_t result;
         for (auto e : in_edges)
         {
             if (filter(e))
@@ -643,9 +712,9 @@ namespace graph_layout
         return result;
     }
 
-    std::set<node_t*> node_t::get_out_nodes() const
+    node_set_t node_t::get_out_nodes() const
     {
-        set<node_t*> out_nodes;
+        node_set_t out_nodes;
         for (auto e : out_edges)
         {
             out_nodes.insert(e->head->owner);
@@ -653,9 +722,9 @@ namespace graph_layout
         return out_nodes;
     }
 
-    std::set<node_t*> node_t::get_in_nodes() const
+    node_set_t node_t::get_in_nodes() const
     {
-        set<node_t*> in_nodes;
+        node_set_t in_nodes;
         for (auto e : in_edges)
         {
             in_nodes.insert(e->head->owner);
@@ -684,7 +753,7 @@ namespace graph_layout
 
     vector<node_t*> node_t::get_uppers() const
     {
-        set<node_t*> upper_nodes;
+        node_set_t upper_nodes;
         for (auto edge : in_edges)
         {
             upper_nodes.insert(edge->tail->owner);
@@ -694,7 +763,7 @@ namespace graph_layout
 
     vector<node_t*> node_t::get_lowers() const
     {
-        set<node_t*> lower_nodes;
+        node_set_t lower_nodes;
         for (auto edge : out_edges)
         {
             lower_nodes.insert(edge->head->owner);
@@ -764,23 +833,38 @@ namespace graph_layout
     {
         if (graph)
         {
-            auto pins_offset = graph->get_pins_offset();
+            unordered_map<pin_t*, pin_t*> pins;
+            for (auto pin : in_pins)
+            {
+                pins[pin->copy_from] = pin;
+            }
+            for (auto pin : out_pins)
+            {
+                pins[pin->copy_from] = pin;
+            }
+            auto border = vector2_t{graph->border.l, graph->border.t};
+            graph->visit_pins_offset([&pins](pin_t* sub_pin, vector2_t offset)
+            {
+                auto it = pins.find(sub_pin);
+                if (it != pins.end())
+                {
+                    it->second->offset = offset;
+                }
+            }, border);
+            // Pins of the node itself rather than of the sub graph sit in the middle of their side.
+            const vector2_t node_size = graph->bound.size() + graph->border.size() * 2;
             for (auto pin : in_pins)
             {
-                auto it = pins_offset.find(pin->copy_from);
-                if (it != pins_offset.end())
+                if (!pin->copy_from)
                 {
-                    auto border = vector2_t{graph->border.l, graph->border.t};
-                    pin->offset = it->second + border;
+                    pin->offset = graph->is_vertical_layout ? vector2_t{node_size.x / 2, 0} : vector2_t{0, node_size.y / 2};
                 }
             }
             for (auto pin : out_pins)
             {
-                auto it = pins_offset.find(pin->copy_from);
-                if (it != pins_offset.end())
+                if (!pin->copy_from)
                 {
-                    auto border = vector2_t{graph->border.l, graph->border.t};
-                    pin->offset = it->second + border;
+                    pin->offset = graph->is_vertical_layout ? vector2_t{node_size.x / 2, node_size.y} : vector2_t{node_size.x, node_size.y / 2};
                 }
             }
             auto comparer = [](const pin_t* a, const pin_t* b)
@@ -797,12 +881,11 @@ namespace graph_layout
         graph = g;
         if (graph)
         {
-            auto pins = graph->get_pins();
-            for (auto p : pins)
+            graph->visit_pins([this](pin_t* p)
             {
                 pin_t* pin = add_pin(p->type);
                 pin->copy_from = p;
-            }
+            });
         }
     }
 
@@ -819,90 +902,10 @@ namespace graph_layout
         delete graph;
     }
 
-    node_t* node_t::clone() const
-    {
-        auto new_node = new node_t();
-        new_node->name = name;
-        if (graph)
-        {
-            new_node->graph = graph->clone();
-        }
-        new_node->position = position;
-        for (auto pin : in_pins)
-        {
-            auto new_pin = new pin_t();
-            new_pin->type = pin->type;
-            new_pin->offset = pin->offset;
-            new_pin->owner = new_node;
-            new_node->in_pins.push_back(new_pin);
-        }
-        for (auto pin : out_pins)
-        {
-            auto new_pin = new pin_t();
-            new_pin->type = pin->type;
-            new_pin->offset = pin->offset;
-            new_pin->owner = new_node;
-            new_node->out_pins.push_back(new_pin);
-        }
-        return new_node;
-    }
-
-    graph_t* connected_graph_t::clone() const
-    {
-        map<node_t*, node_t*> nodes_map;
-        map<pin_t*, pin_t*> pins_map;
-        map<edge_t*, edge_t*> edges_map;
-        map<node_t*, node_t*> nodes_map_inv;
-        map<pin_t*, pin_t*> pins_map_inv;
-        map<edge_t*, edge_t*> edges_map_inv;
-        return clone(nodes_map, pins_map, edges_map, nodes_map_inv, pins_map_inv, edges_map_inv);
-    }
-
-    connected_graph_t* connected_graph_t::clone(std::map<node_t*, node_t*>& nodes_map, std::map<pin_t*, pin_t*>& pins_map, std::map<edge_t*, edge_t*>& edges_map,
-                                                std::map<node_t*, node_t*>& nodes_map_inv, std::map<pin_t*, pin_t*>& pins_map_inv, std::map<edge_t*, edge_t*>& edges_map_inv) const
-    {
-        auto cloned = new connected_graph_t;
-        cloned->bound = bound;
-        for (auto n : nodes)
-        {
-            auto cloned_node = n->clone();
-            nodes_map[cloned_node] = n;
-            nodes_map_inv[n] = cloned_node;
-            for (size_t i = 0; i < n->in_pins.size(); i++)
-            {
-                pins_map_inv[n->in_pins[i]] = cloned_node->in_pins[i];
-                pins_map[cloned_node->in_pins[i]] = n->in_pins[i];
-            }
-            for (size_t i = 0; i < n->out_pins.size(); i++)
-            {
-                pins_map_inv[n->out_pins[i]] = cloned_node->out_pins[i];
-                pins_map[cloned_node->out_pins[i]] = n->out_pins[i];
-            }
-            cloned->nodes.push_back(cloned_node);
-            if (cloned_node->graph)
-            {
-                cloned->sub_graphs.insert(make_pair(cloned_node, cloned_node->graph));
-            }
-        }
-        for (auto e : edges)
-        {
-            auto tail_pin = pins_map_inv[e.second->tail];
-            auto head_pin = pins_map_inv[e.second->head];
-            auto edge = cloned->add_edge(tail_pin, head_pin);
-            edges_map[edge] = e.second;
-            edges_map_inv[e.second] = edge;
-        }
-        return cloned;
-    }
-
-    graph_t* graph_t::clone() const
-    {
-        return nullptr;
-    }
-
     node_t* graph_t::add_node(graph_t* sub_graph)
     {
         auto node = new node_t();
+        node->id = next_id++;
         node->graph = sub_graph;
         if (sub_graph)
         {
@@ -960,6 +963,10 @@ namespace graph_layout
 
     void graph_t::remove_node(node_t* node)
     {
+        if (node == layout_anchor)
+        {
+            layout_anchor = nullptr;
+        }
         if (node->graph)
         {
             sub_graphs.erase(node);
@@ -976,6 +983,7 @@ namespace graph_layout
             return it->second;
         }
         auto edge = new edge_t{tail, head};
+        edge->id = next_id++;
         edges.insert(make_pair(make_pair(tail, head), edge));
         tail->owner->out_edges.push_back(edge);
         head->owner->in_edges.push_back(edge);
@@ -1003,7 +1011,7 @@ namespace graph_layout
         }
     }
 
-    void graph_t::invert_edge(edge_t* edge) const
+    void graph_t::invert_edge(edge_t* edge)
     {
         pin_t* tail = edge->tail;
         pin_t* head = edge->head;
@@ -1019,101 +1027,145 @@ namespace graph_layout
         head_node->out_edges.push_back(edge);
         swap(edge->tail, edge->head);
         edge->is_inverted = true;
+        // Keep the key in sync, remove_edge and the destructor look edges up by their pins.
+        edges.erase(make_pair(tail, head));
+        edges.insert(make_pair(make_pair(edge->tail, edge->head), edge));
     }
 
-    std::vector<std::set<node_t*>> graph_t::to_connected_groups() const
+    std::vector<std::vector<node_t*>> graph_t::to_connected_groups() const
     {
-        vector<set<node_t*>> result;
-        set<node_t*> checked_nodes;
-        vector<node_t*> stack;
-        for (auto node : nodes)
+        unordered_map<const node_t*, size_t> indices;
+        indices.reserve(nodes.size());
+        for (size_t i = 0; i < nodes.size(); i++)
+        {
+            indices[nodes[i]] = i;
+        }
+        vector<size_t> parents(nodes.size());
+        vector<size_t> sizes(nodes.size(), 1);
+        for (size_t i = 0; i < parents.size(); i++)
         {
-            if (checked_nodes.find(node) == checked_nodes.end())
+            parents[i] = i;
+        }
+        auto find_root = [&parents](size_t i)
+        {
+            while (parents[i] != i)
             {
-                checked_nodes.insert(node);
-                stack.push_back(node);
+                parents[i] = parents[parents[i]];
+                i = parents[i];
             }
-            set<node_t*> isolated_nodes;
-            while (!stack.empty())
+            return i;
+        };
+        for (size_t i = 0; i < nodes.size(); i++)
+        {
+            for (auto e : nodes[i]->out_edges)
             {
-                node_t* n = stack.back();
-                stack.pop_back();
-                isolated_nodes.insert(n);
-                set<node_t*> connected_nodes = n->get_direct_connected_nodes([](edge_t* e) { return true; });
-                for (auto ConnectedNode : connected_nodes)
+                auto it = indices.find(e->head->owner);
+                if (it == indices.end())
                 {
-                    if (checked_nodes.find(node) == checked_nodes.end())
-                    {
-                        stack.push_back(ConnectedNode);
-                        checked_nodes.insert(ConnectedNode);
-                    }
+                    continue;
+                }
+                size_t a = find_root(i);
+                size_t b = find_root(it->second);
+                if (a == b)
+                {
+                    continue;
                 }
+                if (sizes[a] < sizes[b])
+                {
+                    swap(a, b);
+                }
+                parents[b] = a;
+                sizes[a] += sizes[b];
             }
-            if (!isolated_nodes.empty())
+        }
+        vector<vector<node_t*>> result;
+        const size_t no_group = numeric_limits<size_t>::max();
+        vector<size_t> group_of_root(nodes.size(), no_group);
+        for (size_t i = 0; i < nodes.size(); i++)
+        {
+            const size_t root = find_root(i);
+            if (group_of_root[root] == no_group)
             {
-                result.push_back(isolated_nodes);
+                group_of_root[root] = result.size();
+                result.emplace_back();
+                result.back().reserve(sizes[root]);
             }
+            result[group_of_root[root]].push_back(nodes[i]);
         }
         return result;
     }
 
-    graph_t* graph_t::to_connected_or_disconnected() const
+    graph_t* graph_t::to_connected_or_disconnected()
     {
         auto groups = to_connected_groups();
         if (groups.size() == 1)
         {
-            return to_connected(groups[0]);
+            // A single component takes the whole graph over as it is.
+            auto graph = new connected_graph_t;
+            static_cast<graph_t&>(*graph) = std::move(*this);
+            return graph;
         }
-        else
+        // Every node is moved, so the groups don't have to be taken out of nodes one by one.
+        nodes.clear();
+        auto disconnected_graph = new disconnected_graph_t;
+        disconnected_graph->spacing = spacing;
+        disconnected_graph->is_vertical_layout = is_vertical_layout;
+        disconnected_graph->thread_pool = thread_pool;
+        disconnected_graph->layout_cache = layout_cache;
+        disconnected_graph->layout_session = layout_session;
+        for (const auto& group : groups)
         {
-            auto disconnected_graph = new disconnected_graph_t;
-            for (const auto& group : groups)
-            {
-                disconnected_graph->add_graph(to_connected(group));
-            }
-            return disconnected_graph;
+            disconnected_graph->add_graph(to_connected(group));
         }
+        user_ptr_to_pin.clear();
+        return disconnected_graph;
     }
 
-    graph_t* graph_t::to_connected(const std::set<node_t*>& nodes)
+    connected_graph_t* graph_t::to_connected(const std::vector<node_t*>& group)
     {
-        map<pin_t*, pin_t*> m;
         auto graph = new connected_graph_t;
-        for (auto n : nodes)
+        graph->spacing = spacing;
+        graph->is_vertical_layout = is_vertical_layout;
+        graph->thread_pool = thread_pool;
+        graph->layout_cache = layout_cache;
+        graph->layout_session = layout_session;
+        // Ids stay unique, they are only compared within one graph.
+        graph->next_id = next_id;
+        graph->nodes = group;
+        for (auto n : group)
         {
-            auto node = graph->add_node(n->graph);
-            node->size = n->size;
-            node->user_ptr = n->user_ptr;
-            for (auto p : n->in_pins)
-            {
-                auto pin = node->add_pin(pin_type_t::in);
-                pin->user_pointer = p->user_pointer;
-                graph->user_ptr_to_pin[p->user_pointer] = pin;
-                m[pin] = p;
-            }
-            for (auto p : n->out_pins)
+            if (n->graph)
             {
-                auto pin = node->add_pin(pin_type_t::in);
-                pin->user_pointer = p->user_pointer;
-                graph->user_ptr_to_pin[p->user_pointer] = pin;
-                m[pin] = p;
+                sub_graphs.erase(n);
+                graph->sub_graphs.insert(make_pair(n, n->graph));
             }
-        }
-        for (auto n : nodes)
-        {
-            for (auto e : n->in_edges)
+            for (auto e : n->out_edges)
             {
-                pin_t* tail = m[e->tail];
-                pin_t* head = m[e->head];
-                graph->add_edge(tail, head);
+                auto key = make_pair(e->tail, e->head);
+                edges.erase(key);
+                graph->edges.insert(make_pair(key, e));
             }
-            for (auto e : n->out_edges)
+            for (auto pins : {&n->in_pins, &n->out_pins})
             {
-                pin_t* tail = m[e->tail];
-                pin_t* head = m[e->head];
-                graph->add_edge(tail, head);
+                for (auto p : *pins)
+                {
+                    if (p->user_pointer)
+                    {
+                        auto it = user_ptr_to_pin.find(p->user_pointer);
+                        if (it != user_ptr_to_pin.end() && it->second == p)
+                        {
+                            graph->user_ptr_to_pin.insert(*it);
+                            user_ptr_to_pin.erase(it);
+                        }
+                    }
+                }
             }
         }
+        if (!nodes.empty())
+        {
+            unordered_set<const node_t*> moved(group.begin(), group.end());
+            nodes.erase(remove_if(nodes.begin(), nodes.end(), [&moved](const node_t* n) { return moved.count(n) != 0; }), nodes.end());
+        }
         return graph;
     }
 
@@ -1139,16 +1191,19 @@ namespace graph_layout
         }
     }
 
-    vector<pin_t*> connected_graph_t::get_pins() const
+    void connected_graph_t::visit_pins(const std::function<void(pin_t*)>& visitor) const
     {
-        vector<pin_t*> pins;
         for (auto n : nodes)
         {
-            pins.reserve(pins.size() + n->in_pins.size() + n->out_pins.size());
-            pins.insert(pins.end(), n->in_pins.begin(), n->in_pins.end());
-            pins.insert(pins.end(), n->out_pins.begin(), n->out_pins.end());
+            for (auto pin : n->in_pins)
+            {
+                visitor(pin);
+            }
+            for (auto pin : n->out_pins)
+            {
+                visitor(pin);
+            }
         }
-        return pins;
     }
 
     vector<node_t*> connected_graph_t::get_source_nodes() const
@@ -1179,16 +1234,55 @@ namespace graph_layout
 
     void connected_graph_t::translate(vector2_t offset)
     {
+        pending_offset = pending_offset + offset;
+        bound = bound.offset_by(offset);
+    }
+
+    void graph_t::set_position(vector2_t position)
+    {
+        translate(vector2_t{position.x - bound.l, position.y - bound.t});
+    }
+
+    void graph_t::resolve_offset()
+    {
+        if (pending_offset.x == 0 && pending_offset.y == 0)
+        {
+            return;
+        }
+        const vector2_t offset = pending_offset;
+        pending_offset = vector2_t{0, 0};
         for (auto n : nodes)
         {
             n->set_position(n->position + offset);
         }
-        bound = bound.offset_by(offset);
     }
 
-    void graph_t::set_position(vector2_t position)
+    std::vector<pin_t*> graph_t::get_pins() const
     {
-        translate(vector2_t{position.x - bound.l, position.y - bound.t});
+        vector<pin_t*> result;
+        visit_pins([&result](pin_t* pin) { result.push_back(pin); });
+        return result;
+    }
+
+    std::map<pin_t*, vector2_t> graph_t::get_pins_offset()
+    {
+        map<pin_t*, vector2_t> result;
+        visit_pins_offset([&result](pin_t* pin, vector2_t offset) { result[pin] = offset; });
+        return result;
+    }
+
+    std::set<void*> graph_t::get_user_pointers() const
+    {
+        set<void*> result;
+        visit_user_pointers([&result](void* user_ptr) { result.insert(user_ptr); });
+        return result;
+    }
+
+    std::map<node_t*, rect_t> graph_t::get_bounds()
+    {
+        map<node_t*, rect_t> result;
+        visit_bounds([&result](node_t* node, const rect_t& rect) { result[node] = rect; });
+        return result;
     }
 
     void disconnected_graph_t::add_graph(graph_t* graph)
@@ -1202,57 +1296,124 @@ namespace graph_layout
         {
             graph->translate(offset);
         }
+        bound = bound.offset_by(offset);
     }
 
-    std::vector<pin_t*> disconnected_graph_t::get_pins() const
+    void disconnected_graph_t::visit_pins(const std::function<void(pin_t*)>& visitor) const
     {
-        std::set<pin_t*> set;
         for (auto graph : connected_graphs)
         {
-            auto pins = graph->get_pins();
-            std::copy(pins.begin(), pins.end(), std::inserter(set, set.end()));
+            graph->visit_pins(visitor);
         }
-        std::vector<pin_t*> result;
-        std::copy(set.begin(), set.end(), std::inserter(result, result.end()));
-        return result;
     }
 
-    std::map<pin_t*, vector2_t> disconnected_graph_t::get_pins_offset()
+    void disconnected_graph_t::visit_pins_offset(const std::function<void(pin_t*, vector2_t)>& visitor, vector2_t origin)
     {
-        std::map<pin_t*, vector2_t> result;
         for (auto graph : connected_graphs)
         {
             const auto& sub_bound = graph->bound;
-            auto offset = vector2_t{sub_bound.l, sub_bound.t} - vector2_t{bound.l, bound.t};
-            auto sub_offsets = graph->get_pins_offset();
-            for (auto& [pin, v] : sub_offsets)
-            {
-                v = v + offset;
-            }
-            std::copy(sub_offsets.begin(), sub_offsets.end(), std::inserter(result, result.end()));
+            graph->visit_pins_offset(visitor, origin + vector2_t{sub_bound.l, sub_bound.t} - vector2_t{bound.l, bound.t});
         }
-        return result;
     }
 
-    std::map<node_t*, rect_t> disconnected_graph_t::get_bounds()
+    void disconnected_graph_t::visit_bounds(const std::function<void(node_t*, const rect_t&)>& visitor)
     {
-        std::map<node_t*, rect_t> result;
         for (auto graph : connected_graphs)
         {
-            auto bounds = graph->get_bounds();
-            std::copy(bounds.begin(), bounds.end(), std::inserter(result, result.end()));
+            graph->visit_bounds(visitor);
+        }
+    }
+
+    // Arranges graphs that share nothing, concurrently when there is a pool. Copies with the same structure, like
+    // pasted comment blocks, are arranged once and the others take the results relative to their own anchor.
+    static void arrange_graphs(const vector<graph_t*>& graphs, thread_pool_t* thread_pool)
+    {
+        vector<graph_t*> originals;
+        vector<pair<graph_t*, graph_t*>> copies;
+        // Graphs of a session start from their own last layout, so copies don't share one.
+        if (graphs.size() > 1 && !graphs[0]->layout_session)
+        {
+            unordered_map<uint64_t, graph_t*> by_structure;
+            for (auto graph : graphs)
+            {
+                auto [it, inserted] = by_structure.emplace(structural_hash(graph), graph);
+                if (inserted)
+                {
+                    originals.push_back(graph);
+                }
+                else
+                {
+                    copies.emplace_back(graph, it->second);
+                }
+            }
+        }
+        else
+        {
+            originals = graphs;
+        }
+        if (thread_pool && originals.size() > 1)
+        {
+            thread_pool->parallel_for(originals.size(), [&originals](size_t i) { originals[i]->arrange(); });
+        }
+        else
+        {
+            for (auto graph : originals)
+            {
+                graph->arrange();
+            }
+        }
+        unordered_map<graph_t*, shared_ptr<cached_layout_t>> layouts;
+        for (auto [copy, original] : copies)
+        {
+            auto& layout = layouts[original];
+            if (!layout && original->layout_anchor)
+            {
+                layout = cached_layout_t::capture(original, original->layout_anchor);
+            }
+            copy->layout_anchor = layout ? layout->apply(copy) : nullptr;
+            if (!copy->layout_anchor)
+            {
+                copy->arrange();
+            }
         }
-        return result;
     }
 
     void disconnected_graph_t::arrange()
     {
+        for (auto graph : connected_graphs)
+        {
+            if (!graph->thread_pool)
+            {
+                graph->thread_pool = thread_pool;
+            }
+            if (!graph->layout_cache)
+            {
+                graph->layout_cache = layout_cache;
+            }
+            if (!graph->layout_session)
+            {
+                graph->layout_session = layout_session;
+            }
+        }
+        if (thread_pool && connected_graphs.size() > 1)
+        {
+            // Components share nothing, so they are arranged concurrently, biggest first to keep the threads busy.
+            // Stacking below still runs in the original order, the result is the same as arranging one by one.
+            vector<graph_t*> by_size = connected_graphs;
+            stable_sort(by_size.begin(), by_size.end(), [](const graph_t* a, const graph_t* b) { return a->nodes.size() > b->nodes.size(); });
+            arrange_graphs(by_size, thread_pool);
+        }
+        else
+        {
+            arrange_graphs(connected_graphs, nullptr);
+        }
+        // The first component stays where it is.
+        layout_anchor = connected_graphs.empty() ? nullptr : connected_graphs.front()->layout_anchor;
+
         rect_t pre_bound;
         bool bound_valid = false;
         for (auto graph : connected_graphs)
         {
-            graph->arrange();
-
             if (bound_valid)
             {
                 vector2_t start_corner = is_vertical_layout ? vector2_t{pre_bound.r, pre_bound.t} : vector2_t{pre_bound.l, pre_bound.b};
@@ -1274,15 +1435,12 @@ namespace graph_layout
         }
     }
 
-    std::set<void*> disconnected_graph_t::get_user_pointers()
+    void disconnected_graph_t::visit_user_pointers(const std::function<void(void*)>& visitor) const
     {
-        set<void*> result;
         for (auto graph : connected_graphs)
         {
-            auto user_pointers = graph->get_user_pointers();
-            std::copy(user_pointers.begin(), user_pointers.end(), std::inserter(result, result.end()));
+            graph->visit_user_pointers(visitor);
         }
-        return result;
     }
 
     disconnected_graph_t::~disconnected_graph_t()
@@ -1293,22 +1451,11 @@ namespace graph_layout
         }
     }
 
-    void connected_graph_t::acyclic() const
+    vector<edge_t*> connected_graph_t::depth_first_feedback_edges() const
     {
-        if (nodes.empty())
-        {
-            return;
-        }
         set<node_t*> visited_set;
         vector<edge_t*> non_tree_edges;
-        map<node_t*, node_t*> nodes_map;
-        map<pin_t*, pin_t*> pins_map;
-        map<edge_t*, edge_t*> edges_map;
-        map<node_t*, node_t*> nodes_map_inv;
-        map<pin_t*, pin_t*> pins_map_inv;
-        map<edge_t*, edge_t*> edges_map_inv;
-        connected_graph_t* tree = clone(nodes_map, pins_map, edges_map, nodes_map_inv, pins_map_inv, edges_map_inv);
-        vector<node_t*> source_nodes = tree->get_source_nodes();
+        vector<node_t*> source_nodes = get_source_nodes();
         if (!source_nodes.empty())
         {
             for (auto n : source_nodes)
@@ -1322,7 +1469,7 @@ namespace graph_layout
         }
         else
         {
-            vector<node_t*> sink_nodes = tree->get_sink_nodes();
+            vector<node_t*> sink_nodes = get_sink_nodes();
             if (!sink_nodes.empty())
             {
                 for (auto n : sink_nodes)
@@ -1336,119 +1483,1430 @@ namespace graph_layout
             }
             else
             {
-                visited_set.insert(tree->nodes[0]);
-                dfs(tree->nodes[0], visited_set, nullptr, [&non_tree_edges](edge_t* e)
+                visited_set.insert(nodes[0]);
+                dfs(nodes[0], visited_set, nullptr, [&non_tree_edges](edge_t* e)
+                {
+                    non_tree_edges.push_back(e);
+                });
+            }
+        }
+        // A cycle that no source reaches is still unvisited.
+        for (auto n : nodes)
+        {
+            if (visited_set.find(n) == visited_set.end())
+            {
+                visited_set.insert(n);
+                dfs(n, visited_set, nullptr, [&non_tree_edges](edge_t* e)
                 {
                     non_tree_edges.push_back(e);
                 });
             }
         }
 
-        vector<pair<node_t*, node_t*>> node_pairs;
-        vector<edge_t*> original_non_tree_edges;
+        // The search forest is the graph without its non tree edges, read through a mask.
+        edge_mask_t tree;
         for (auto e : non_tree_edges)
         {
-            auto tail_node = e->tail->owner;
-            auto head_node = e->head->owner;
-            original_non_tree_edges.push_back(edges_map[e]);
-            node_pairs.emplace_back(tail_node, head_node);
-            tree->remove_edge(e);
+            tree.mask(e);
         }
-        for (size_t i = 0; i < node_pairs.size(); i++)
+        vector<edge_t*> feedback_edges;
+        for (auto e : non_tree_edges)
         {
-            auto p = node_pairs[i];
-            if (p.first->is_descendant_of(p.second))
+            if (tree.is_descendant_of(e->tail->owner, e->head->owner))
             {
-                invert_edge(original_non_tree_edges[i]);
-                printf("invert edge: %s->%s\n", original_non_tree_edges[i]->head->owner->name.c_str(), original_non_tree_edges[i]->tail->owner->name.c_str());
+                feedback_edges.push_back(e);
             }
         }
-        delete tree;
+        return feedback_edges;
     }
 
-    void connected_graph_t::rank() const
+    // Weighted Eades-Lin-Smyth: sinks go to the back of the sequence, sources to the front, otherwise the node with
+    // the most weight going out over coming in goes to the front. Nodes wait in buckets by that difference, so the
+    // pass takes time linear in the edges and the largest weight per node. Edges pointing back in the sequence are
+    // returned, self loops too.
+    static vector<edge_t*> greedy_feedback_edges(const vector<node_t*>& nodes)
     {
-        tree_t tree = feasible_tree();
-        tree.calculate_cut_values();
-        while (edge_t* e = tree.leave_edge())
+        constexpr size_t none = numeric_limits<size_t>::max();
+        enum class state_t { bucket, queued, removed, };
+        struct entry_t
         {
-            edge_t* f = tree.enter_edge(e);
-            tree.exchange(e, f);
+            size_t in_degree = 0;
+            size_t out_degree = 0;
+            int64_t delta = 0;
+            size_t prev = none;
+            size_t next = none;
+            state_t state = state_t::bucket;
+        };
+        unordered_map<const node_t*, size_t> indices;
+        indices.reserve(nodes.size());
+        for (size_t i = 0; i < nodes.size(); i++)
+        {
+            indices[nodes[i]] = i;
         }
-        normalize();
-    }
-
-    void connected_graph_t::add_dummy_nodes(tree_t* feasible_tree)
-    {
-        vector<edge_t*> edges_vec;
-        transform(edges.begin(), edges.end(), back_inserter(edges_vec), [](auto& p) { return p.second; });
-        for (auto edge : edges_vec)
+        vector<entry_t> entries(nodes.size());
+        int64_t max_out = 0, max_in = 0;
+        for (size_t i = 0; i < nodes.size(); i++)
         {
-            int edge_len = edge->length();
-            if (edge_len > 1)
+            int64_t out_weight = 0, in_weight = 0;
+            for (auto e : nodes[i]->out_edges)
             {
-                bool is_tree_edge = feasible_tree && feasible_tree->tree_edges.find(edge) != feasible_tree->tree_edges.end();
-                pin_t* tail = edge->tail;
-                for (int i = 0; i < edge_len - 1; i++)
+                if (e->head->owner != nodes[i])
                 {
-                    node_t* dummy = add_node("dummy");
-                    dummy->is_dummy_node = true;
-                    if (is_tree_edge) feasible_tree->nodes.insert(dummy);
-                    dummy->rank = edge->tail->owner->rank + i + 1;
-                    pin_t* dummy_in = dummy->add_pin(pin_type_t::in);
-                    pin_t* dummy_out = dummy->add_pin(pin_type_t::out);
-                    edge_t* dummy_edge = add_edge(tail, dummy_in);
-                    if (is_tree_edge) feasible_tree->tree_edges.insert(dummy_edge);
-                    tail = dummy_out;
+                    entries[i].out_degree++;
+                    out_weight += max(e->weight, 0);
                 }
-                edge_t* dummy_edge = add_edge(tail, edge->head);
-                if (is_tree_edge)
+            }
+            for (auto e : nodes[i]->in_edges)
+            {
+                if (e->tail->owner != nodes[i])
                 {
-                    feasible_tree->tree_edges.insert(dummy_edge);
-                    feasible_tree->tree_edges.erase(edge);
+                    entries[i].in_degree++;
+                    in_weight += max(e->weight, 0);
                 }
-                remove_edge(edge);
             }
+            entries[i].delta = out_weight - in_weight;
+            max_out = max(max_out, out_weight);
+            max_in = max(max_in, in_weight);
         }
-    }
 
-    void connected_graph_t::assign_layers()
-    {
-        map<int, vector<node_t*>> rank_layer_map;
-        for (auto n : nodes)
+        // Differences only grow by the weight of a removed in edge, so the highest bucket is found by walking down
+        // from the last one filled.
+        vector<size_t> buckets(static_cast<size_t>(max_out + max_in + 1), none);
+        size_t top = 0;
+        auto link = [&](size_t i)
         {
-            rank_layer_map[n->rank].push_back(n);
-        }
-        layers.resize(rank_layer_map.size());
-        for (auto [rank, layer] : rank_layer_map)
+            const auto bucket = static_cast<size_t>(entries[i].delta + max_in);
+            entries[i].prev = none;
+            entries[i].next = buckets[bucket];
+            if (buckets[bucket] != none)
+            {
+                entries[buckets[bucket]].prev = i;
+            }
+            buckets[bucket] = i;
+            top = max(top, bucket);
+        };
+        auto unlink = [&](size_t i)
         {
-            layers[rank] = std::move(layer);
-        }
+            const auto bucket = static_cast<size_t>(entries[i].delta + max_in);
+            if (entries[i].prev != none)
+            {
+                entries[entries[i].prev].next = entries[i].next;
+            }
+            else
+            {
+                buckets[bucket] = entries[i].next;
+            }
+            if (entries[i].next != none)
+            {
+                entries[entries[i].next].prev = entries[i].prev;
+            }
+        };
+        vector<size_t> sinks, sources;
+        for (size_t i = 0; i < nodes.size(); i++)
+        {
+            if (entries[i].out_degree == 0 || entries[i].in_degree == 0)
+            {
+                entries[i].state = state_t::queued;
+                (entries[i].out_degree == 0 ? sinks : sources).push_back(i);
+            }
+            else
+            {
+                link(i);
+            }
+        }
+
+        vector<size_t> front, back;
+        front.reserve(nodes.size());
+        auto remove = [&](size_t i)
+        {
+            entries[i].state = state_t::removed;
+            for (auto e : nodes[i]->out_edges)
+            {
+                const size_t head = indices.at(e->head->owner);
+                auto& entry = entries[head];
+                if (entry.state == state_t::removed || head == i)
+                {
+                    continue;
+                }
+                entry.in_degree--;
+                if (entry.state == state_t::bucket)
+                {
+                    unlink(head);
+                    entry.delta += max(e->weight, 0);
+                    if (entry.in_degree == 0)
+                    {
+                        entry.state = state_t::queued;
+                        sources.push_back(head);
+                    }
+                    else
+                    {
+                        link(head);
+                    }
+                }
+            }
+            for (auto e : nodes[i]->in_edges)
+            {
+                const size_t tail = indices.at(e->tail->owner);
+                auto& entry = entries[tail];
+                if (entry.state == state_t::removed || tail == i)
+                {
+                    continue;
+                }
+                entry.out_degree--;
+                if (entry.state == state_t::bucket)
+                {
+                    unlink(tail);
+                    entry.delta -= max(e->weight, 0);
+                    if (entry.out_degree == 0)
+                    {
+                        entry.state = state_t::queued;
+                        sinks.push_back(tail);
+                    }
+                    else
+                    {
+                        link(tail);
+                    }
+                }
+            }
+        };
+        for (size_t removed = 0; removed < nodes.size(); removed++)
+        {
+            size_t i;
+            if (!sinks.empty())
+            {
+                i = sinks.back();
+                sinks.pop_back();
+                back.push_back(i);
+            }
+            else if (!sources.empty())
+            {
+                i = sources.back();
+                sources.pop_back();
+                front.push_back(i);
+            }
+            else
+            {
+                while (buckets[top] == none)
+                {
+                    top--;
+                }
+                i = buckets[top];
+                unlink(i);
+                front.push_back(i);
+            }
+            remove(i);
+        }
+
+        vector<size_t> positions(nodes.size());
+        for (size_t i = 0; i < front.size(); i++)
+        {
+            positions[front[i]] = i;
+        }
+        for (size_t i = 0; i < back.size(); i++)
+        {
+            positions[back[i]] = nodes.size() - 1 - i;
+        }
+        vector<edge_t*> feedback_edges;
+        for (auto n : nodes)
+        {
+            for (auto e : n->out_edges)
+            {
+                if (positions[indices.at(e->head->owner)] <= positions[indices.at(n)])
+                {
+                    feedback_edges.push_back(e);
+                }
+            }
+        }
+        return feedback_edges;
+    }
+
+    acyclic_stats_t connected_graph_t::acyclic()
+    {
+        acyclic_stats_t stats;
+        if (nodes.empty())
+        {
+            return stats;
+        }
+        const vector<edge_t*> feedback_edges = acyclic_mode == acyclic_mode_t::greedy ? greedy_feedback_edges(nodes) : depth_first_feedback_edges();
+        for (auto e : feedback_edges)
+        {
+            stats.inverted_edges++;
+            stats.inverted_weight += static_cast<size_t>(max(e->weight, 0));
+            invert_edge(e);
+        }
+        return stats;
+    }
+
+    // Edges of candidates joining nodes that aren't joined yet, in their order. A spanning tree when candidates connect all nodes.
+    static vector<edge_t*> spanning_edges(const vector<node_t*>& nodes, const vector<edge_t*>& candidates)
+    {
+        unordered_map<const node_t*, size_t> indices;
+        indices.reserve(nodes.size());
+        for (size_t i = 0; i < nodes.size(); i++)
+        {
+            indices[nodes[i]] = i;
+        }
+        vector<size_t> parents(nodes.size());
+        for (size_t i = 0; i < parents.size(); i++)
+        {
+            parents[i] = i;
+        }
+        auto find_root = [&parents](size_t i)
+        {
+            while (parents[i] != i)
+            {
+                parents[i] = parents[parents[i]];
+                i = parents[i];
+            }
+            return i;
+        };
+        vector<edge_t*> result;
+        for (auto e : candidates)
+        {
+            auto tail = indices.find(e->tail->owner);
+            auto head = indices.find(e->head->owner);
+            if (tail == indices.end() || head == indices.end())
+            {
+                continue;
+            }
+            const size_t a = find_root(tail->second);
+            const size_t b = find_root(head->second);
+            if (a != b)
+            {
+                parents[b] = a;
+                result.push_back(e);
+            }
+        }
+        return result;
+    }
+
+    static float elapsed_ms(chrono::steady_clock::time_point start)
+    {
+        return chrono::duration<float, milli>(chrono::steady_clock::now() - start).count();
+    }
+
+    static void measure_lengths(const connected_graph_t* graph, rank_stats_t& stats)
+    {
+        stats.total_length = 0;
+        stats.weighted_length = 0;
+        for (auto& [key, e] : graph->edges)
+        {
+            const auto length = static_cast<size_t>(std::max(e->length(), 0));
+            stats.total_length += length;
+            stats.weighted_length += length * static_cast<size_t>(std::max(e->weight, 0));
+        }
+    }
+
+    rank_stats_t connected_graph_t::rank(const rank_seed_t* seed, rank_seed_t* result) const
+    {
+        rank_stats_t stats;
+        const auto start = chrono::steady_clock::now();
+        if (is_bounded_ranking && max_rank_pivots == 0 && !seed && !result)
+        {
+            init_rank();
+            normalize();
+            measure_lengths(this, stats);
+            stats.elapsed_ms = elapsed_ms(start);
+            return stats;
+        }
+        auto is_out_of_time = [this, start]()
+        {
+            return is_bounded_ranking && elapsed_ms(start) >= rank_time_budget_ms;
+        };
+        tree_t tree = seed ? seeded_feasible_tree(*seed, stats, is_out_of_time) : feasible_tree(is_out_of_time);
+        // A tree short of nodes ran out of time while growing, there are no cut values to pivot on.
+        const bool is_spanning = tree.nodes.size() == nodes.size();
+        stats.is_stopped_early = !is_spanning;
+        if (is_spanning)
+        {
+            tree.calculate_cut_values();
+        }
+        while (edge_t* e = is_spanning ? tree.leave_edge() : nullptr)
+        {
+            if (is_bounded_ranking && (stats.pivots >= max_rank_pivots || is_out_of_time()))
+            {
+                stats.is_stopped_early = true;
+                break;
+            }
+            edge_t* f = tree.enter_edge(e);
+            tree.exchange(e, f);
+            stats.pivots++;
+        }
+        normalize();
+        measure_lengths(this, stats);
+        stats.elapsed_ms = elapsed_ms(start);
+        if (result)
+        {
+            result->ranks.clear();
+            for (auto n : nodes)
+            {
+                result->ranks[n] = n->rank;
+            }
+            // The tree can hold every tight edge, a spanning tree is picked out of it.
+            const vector<edge_t*> tree_edges(tree.tree_edges.begin(), tree.tree_edges.end());
+            const auto spanning = spanning_edges(nodes, tree_edges);
+            result->tree_edges.assign(spanning.begin(), spanning.end());
+        }
+        return stats;
+    }
+
+    bool connected_graph_t::rank_compressed_chains(rank_stats_t* stats) const
+    {
+        const auto start = chrono::steady_clock::now();
+        auto is_inner = [this](const node_t* n)
+        {
+            return n->in_edges.size() == 1 && n->out_edges.size() == 1 && n != min_ranking_node && n != max_ranking_node;
+        };
+        size_t inner_count = 0;
+        for (auto n : nodes)
+        {
+            inner_count += is_inner(n) ? 1 : 0;
+        }
+        if (inner_count == 0)
+        {
+            return false;
+        }
+
+        // Every chain costs the lowest weight along it per rank it spans beyond the sum of its minimum lengths,
+        // so it is one edge with that weight and length. Chains and edges between the same ends add up their weights.
+        connected_graph_t compressed;
+        unordered_map<node_t*, node_t*> ends;
+        for (auto n : nodes)
+        {
+            if (!is_inner(n))
+            {
+                node_t* end = compressed.add_node();
+                end->add_pin(pin_type_t::in);
+                end->add_pin(pin_type_t::out);
+                ends[n] = end;
+            }
+        }
+        // Each chain as its first edge, only chains hang from the ends, cycles are gone after acyclic().
+        vector<const edge_t*> chains;
+        for (auto n : nodes)
+        {
+            if (is_inner(n))
+            {
+                continue;
+            }
+            for (auto e : n->out_edges)
+            {
+                int min_length = e->min_length;
+                int weight = e->weight;
+                const edge_t* last = e;
+                while (is_inner(last->head->owner))
+                {
+                    last = last->head->owner->out_edges[0];
+                    min_length += last->min_length;
+                    weight = std::min(weight, last->weight);
+                }
+                if (last != e)
+                {
+                    chains.push_back(e);
+                }
+                node_t* tail = ends[n];
+                node_t* head = ends[last->head->owner];
+                auto it = compressed.edges.find(make_pair(tail->out_pins[0], head->in_pins[0]));
+                if (it == compressed.edges.end())
+                {
+                    edge_t* added = compressed.add_edge(tail->out_pins[0], head->in_pins[0]);
+                    added->min_length = min_length;
+                    added->weight = weight;
+                }
+                else
+                {
+                    it->second->min_length = std::max(it->second->min_length, min_length);
+                    it->second->weight += weight;
+                }
+            }
+        }
+        if (min_ranking_node)
+        {
+            compressed.min_ranking_node = ends[min_ranking_node];
+        }
+        if (max_ranking_node)
+        {
+            compressed.max_ranking_node = ends[max_ranking_node];
+        }
+        compressed.is_bounded_ranking = is_bounded_ranking;
+        compressed.max_rank_pivots = max_rank_pivots;
+        compressed.rank_time_budget_ms = rank_time_budget_ms - elapsed_ms(start);
+        const rank_stats_t compressed_stats = compressed.rank();
+
+        for (auto [n, end] : ends)
+        {
+            n->rank = end->rank;
+        }
+        for (auto first : chains)
+        {
+            int min_length = 0;
+            const edge_t* lowest = first;
+            const edge_t* last = first;
+            for (const edge_t* e = first;; e = e->head->owner->out_edges[0])
+            {
+                min_length += e->min_length;
+                lowest = e->weight < lowest->weight ? e : lowest;
+                last = e;
+                if (!is_inner(e->head->owner))
+                {
+                    break;
+                }
+            }
+            const int slack = last->head->owner->rank - first->tail->owner->rank - min_length;
+            for (const edge_t* e = first; e != last; e = e->head->owner->out_edges[0])
+            {
+                e->head->owner->rank = e->tail->owner->rank + e->min_length + (e == lowest ? slack : 0);
+            }
+        }
+        if (stats)
+        {
+            *stats = compressed_stats;
+            measure_lengths(this, *stats);
+            stats->elapsed_ms = elapsed_ms(start);
+        }
+        return true;
+    }
+
+    tree_t connected_graph_t::seeded_feasible_tree(const rank_seed_t& seed, rank_stats_t& stats, const std::function<bool()>& is_out_of_time) const
+    {
+        for (auto [key, e] : edges)
+        {
+            auto tail = seed.ranks.find(e->tail->owner);
+            auto head = seed.ranks.find(e->head->owner);
+            if (tail != seed.ranks.end() && head != seed.ranks.end() && head->second - tail->second < e->min_length)
+            {
+                stats.repaired_edges++;
+            }
+        }
+
+        // Nodes keep their seeded rank unless an in edge needs them further down, which repairs the violated edges.
+        unordered_map<const node_t*, size_t> in_degrees;
+        vector<node_t*> sorted;
+        for (auto n : nodes)
+        {
+            in_degrees[n] = n->in_edges.size();
+            if (n->in_edges.empty())
+            {
+                sorted.push_back(n);
+            }
+        }
+        for (size_t i = 0; i < sorted.size(); i++)
+        {
+            for (auto e : sorted[i]->out_edges)
+            {
+                if (--in_degrees[e->head->owner] == 0)
+                {
+                    sorted.push_back(e->head->owner);
+                }
+            }
+        }
+        if (sorted.size() != nodes.size())
+        {
+            // Not acyclic yet, nothing to repair from.
+            return feasible_tree(is_out_of_time);
+        }
+        const int unset = numeric_limits<int>::min();
+        for (auto n : sorted)
+        {
+            auto it = seed.ranks.find(n);
+            int rank = it != seed.ranks.end() ? it->second : unset;
+            for (auto e : n->in_edges)
+            {
+                rank = max(rank, e->tail->owner->rank + e->min_length);
+            }
+            if (rank == unset)
+            {
+                // A source without a seed goes right above the seeded nodes it points to.
+                for (auto e : n->out_edges)
+                {
+                    auto head = seed.ranks.find(e->head->owner);
+                    if (head != seed.ranks.end())
+                    {
+                        rank = rank == unset ? head->second - e->min_length : min(rank, head->second - e->min_length);
+                    }
+                }
+            }
+            n->rank = rank == unset ? 0 : rank;
+        }
+
+        if (!seed.tree_edges.empty() && seed.tree_edges.size() + 1 == nodes.size())
+        {
+            // The seed may come from another graph, its edges are only looked up, never followed.
+            unordered_map<const edge_t*, edge_t*> own_edges;
+            for (auto [key, e] : edges)
+            {
+                own_edges[e] = e;
+            }
+            vector<edge_t*> candidates;
+            for (auto e : seed.tree_edges)
+            {
+                auto it = own_edges.find(e);
+                if (it == own_edges.end() || it->second->slack() != 0)
+                {
+                    break;
+                }
+                candidates.push_back(it->second);
+            }
+            if (candidates.size() == seed.tree_edges.size() && spanning_edges(nodes, candidates).size() == candidates.size())
+            {
+                tree_t tree;
+                tree.nodes.insert(nodes.begin(), nodes.end());
+                tree.tree_edges.insert(candidates.begin(), candidates.end());
+                tree.update_non_tree_edges(edges);
+                stats.is_seed_tree_used = true;
+                return tree;
+            }
+        }
+        return grow_feasible_tree(is_out_of_time);
+    }
+
+    void connected_graph_t::add_dummy_nodes(tree_t* feasible_tree)
+    {
+        vector<edge_t*> edges_vec;
+        transform(edges.begin(), edges.end(), back_inserter(edges_vec), [](auto& p) { return p.second; });
+        // Long edges, one per bundle, or all those leaving one pin in the bundle of their first.
+        vector<vector<edge_t*>> bundles;
+        unordered_map<const pin_t*, size_t> pin_bundles;
+        for (auto edge : edges_vec)
+        {
+            if (edge->length() <= 1)
+            {
+                continue;
+            }
+            if (is_edge_bundling_enabled)
+            {
+                auto [it, is_new] = pin_bundles.emplace(edge->tail, bundles.size());
+                if (!is_new)
+                {
+                    bundles[it->second].push_back(edge);
+                    continue;
+                }
+            }
+            bundles.push_back(vector<edge_t*>{edge});
+        }
+        for (auto& bundle : bundles)
+        {
+            // The chain reaches the rank above the farthest head, every edge leaves it at the rank above its own.
+            int chain_length = 0;
+            for (auto edge : bundle)
+            {
+                chain_length = std::max(chain_length, edge->length() - 1);
+            }
+            pin_t* tail = bundle[0]->tail;
+            const int tail_rank = tail->owner->rank;
+            vector<node_t*> chain;
+            vector<edge_t*> segments;
+            for (int i = 0; i < chain_length; i++)
+            {
+                node_t* dummy = add_node("dummy");
+                dummy->is_dummy_node = true;
+                dummy->rank = tail_rank + i + 1;
+                pin_t* dummy_in = dummy->add_pin(pin_type_t::in);
+                pin_t* dummy_out = dummy->add_pin(pin_type_t::out);
+                segments.push_back(add_edge(tail, dummy_in));
+                chain.push_back(dummy);
+                tail = dummy_out;
+            }
+            for (auto edge : bundle)
+            {
+                const size_t leave = static_cast<size_t>(edge->length() - 2);
+                edge_t* dummy_edge = add_edge(chain[leave]->out_pins[0], edge->head);
+                if (feasible_tree && feasible_tree->tree_edges.find(edge) != feasible_tree->tree_edges.end())
+                {
+                    for (size_t i = 0; i <= leave; i++)
+                    {
+                        feasible_tree->nodes.insert(chain[i]);
+                        feasible_tree->tree_edges.insert(segments[i]);
+                    }
+                    feasible_tree->tree_edges.insert(dummy_edge);
+                    feasible_tree->tree_edges.erase(edge);
+                }
+                remove_edge(edge);
+            }
+        }
+    }
+
+    void connected_graph_t::assign_layers()
+    {
+        map<int, vector<node_t*>> rank_layer_map;
+        for (auto n : nodes)
+        {
+            rank_layer_map[n->rank].push_back(n);
+        }
+        layers.resize(rank_layer_map.size());
+        for (auto [rank, layer] : rank_layer_map)
+        {
+            layers[rank] = std::move(layer);
+        }
+    }
+
+    // Pairs with a before b crossing each other, for lists of pin indices in ascending order.
+    static size_t count_crossings(const vector<int>& a, const vector<int>& b)
+    {
+        size_t count = 0;
+        size_t j = 0;
+        for (auto index : a)
+        {
+            while (j < b.size() && b[j] < index)
+            {
+                j++;
+            }
+            count += j;
+        }
+        return count;
+    }
+
+    // Pin indices of the other ends of the edges of every node in a layer, to the layer above and below, ascending.
+    struct layer_ends_t
+    {
+        vector<int> upper;
+        vector<int> lower;
+    };
+
+    static unordered_map<const node_t*, layer_ends_t> get_layer_ends(const vector<node_t*>& layer)
+    {
+        unordered_map<const node_t*, layer_ends_t> ends;
+        for (auto n : layer)
+        {
+            auto& node_ends = ends[n];
+            for (auto e : n->in_edges)
+            {
+                if (e->tail->owner->rank == n->rank - 1)
+                {
+                    node_ends.upper.push_back(e->tail->index_in_layer);
+                }
+            }
+            for (auto e : n->out_edges)
+            {
+                if (e->head->owner->rank == n->rank + 1)
+                {
+                    node_ends.lower.push_back(e->head->index_in_layer);
+                }
+            }
+            sort(node_ends.upper.begin(), node_ends.upper.end());
+            sort(node_ends.lower.begin(), node_ends.lower.end());
+        }
+        return ends;
+    }
+
+    // Moves n to the place in its layer where its edges cross the fewest others and returns the crossings removed.
+    // With the layers next to it fixed, edges of two nodes cross by the order of their ends there alone, so the
+    // crossings a move adds or removes come from the counts of the pairs it swaps.
+    static size_t sift_node(vector<node_t*>& layer, const node_t* n, const unordered_map<const node_t*, layer_ends_t>& ends)
+    {
+        const auto& n_ends = ends.at(n);
+        if (n_ends.upper.empty() && n_ends.lower.empty())
+        {
+            return 0;
+        }
+        vector<node_t*> others;
+        others.reserve(layer.size() - 1);
+        size_t position = 0;
+        node_t* moved = nullptr;
+        for (auto other : layer)
+        {
+            if (other == n)
+            {
+                position = others.size();
+                moved = other;
+            }
+            else
+            {
+                others.push_back(other);
+            }
+        }
+        // Crossings relative to n going first, the current place wins ties.
+        int delta = 0;
+        int current_delta = 0;
+        int best_delta = 0;
+        size_t best_position = 0;
+        for (size_t i = 0; i <= others.size(); i++)
+        {
+            if (i == position)
+            {
+                current_delta = delta;
+            }
+            if (delta < best_delta || (delta == best_delta && i == position))
+            {
+                best_delta = delta;
+                best_position = i;
+            }
+            if (i < others.size())
+            {
+                const auto& other_ends = ends.at(others[i]);
+                const size_t before = count_crossings(n_ends.upper, other_ends.upper) + count_crossings(n_ends.lower, other_ends.lower);
+                const size_t after = count_crossings(other_ends.upper, n_ends.upper) + count_crossings(other_ends.lower, n_ends.lower);
+                delta += static_cast<int>(after) - static_cast<int>(before);
+            }
+        }
+        if (best_position == position || best_delta >= current_delta)
+        {
+            return 0;
+        }
+        others.insert(others.begin() + static_cast<ptrdiff_t>(best_position), moved);
+        layer = std::move(others);
+        return static_cast<size_t>(current_delta - best_delta);
+    }
+
+    void connected_graph_t::ordering()
+    {
+        vector<node_t*> hubs;
+        if (hub_degree > 0 && !is_stable_ordering)
+        {
+            for (auto n : nodes)
+            {
+                if (n->in_edges.size() + n->out_edges.size() > hub_degree)
+                {
+                    hubs.push_back(n);
+                }
+            }
+        }
+        if (hubs.empty())
+        {
+            sweep_layers();
+            return;
+        }
+
+        // Hubs and their edges are left out of the sweeps, the lists of edges they touch are put back as they were.
+        unordered_map<node_t*, pair<vector<edge_t*>, vector<edge_t*>>> saved_edges;
+        unordered_set<const edge_t*> hub_edges;
+        for (auto hub : hubs)
+        {
+            saved_edges.emplace(hub, make_pair(hub->in_edges, hub->out_edges));
+            for (auto e : hub->in_edges)
+            {
+                saved_edges.emplace(e->tail->owner, make_pair(e->tail->owner->in_edges, e->tail->owner->out_edges));
+                hub_edges.insert(e);
+            }
+            for (auto e : hub->out_edges)
+            {
+                saved_edges.emplace(e->head->owner, make_pair(e->head->owner->in_edges, e->head->owner->out_edges));
+                hub_edges.insert(e);
+            }
+        }
+        auto is_hub_edge = [&hub_edges](const edge_t* e) { return hub_edges.count(e) > 0; };
+        for (auto& [n, saved] : saved_edges)
+        {
+            n->in_edges.erase(remove_if(n->in_edges.begin(), n->in_edges.end(), is_hub_edge), n->in_edges.end());
+            n->out_edges.erase(remove_if(n->out_edges.begin(), n->out_edges.end(), is_hub_edge), n->out_edges.end());
+        }
+        sweep_layers();
+        for (auto& [n, saved] : saved_edges)
+        {
+            n->in_edges = std::move(saved.first);
+            n->out_edges = std::move(saved.second);
+        }
+
+        // Each hub then goes where its edges cross the fewest others, with the layers next to it as they are.
+        crossing(layers, true);
+        for (auto hub : hubs)
+        {
+            auto& layer = layers[hub->rank];
+            if (layer.size() > 1)
+            {
+                sift_node(layer, hub, get_layer_ends(layer));
+                calculate_pins_index_in_layer(layer);
+            }
+        }
+    }
+
+    void connected_graph_t::sweep_layers()
+    {
+        if (is_stable_ordering)
+        {
+            // Starting close to the result, once a sweep down and one up change nothing the next ones won't either.
+            const auto anchors = order_layers_by_position();
+            auto order = layers;
+            auto best = layers;
+            auto best_crossing = estimate_crossing(best, crossing_sample_size);
+            size_t unchanged_sweeps = 0;
+            for (size_t i = 0; i < stable_iterations && unchanged_sweeps < 2; i++)
+            {
+                auto previous = order;
+                sort_layers(order, i % 2 == 0, &anchors);
+                const auto new_crossing = estimate_crossing(order, crossing_sample_size);
+                if (new_crossing.is_fewer_than(best_crossing))
+                {
+                    best = order;
+                    best_crossing = new_crossing;
+                }
+                unchanged_sweeps = order == previous ? unchanged_sweeps + 1 : 0;
+            }
+            layers = best;
+            return;
+        }
+        auto order = layers;
+        auto best = layers;
+        auto best_crossing = estimate_crossing(best, crossing_sample_size);
+        for (size_t i = 0; i < max_iterations; i++)
+        {
+            sort_layers(order, i % 2 == 0);
+            const auto new_crossing = estimate_crossing(order, crossing_sample_size);
+            if (new_crossing.is_fewer_than(best_crossing))
+            {
+                best = order;
+                best_crossing = new_crossing;
+            }
+        }
+        if (is_sifting_enabled)
+        {
+            // Pins of inverted edges are counted with the other side of their node, the total decides.
+            auto sifted = best;
+            const size_t best_count = crossing(sifted, true);
+            sift_layers(sifted);
+            if (crossing(sifted, true) < best_count)
+            {
+                best = std::move(sifted);
+            }
+        }
+        layers = best;
+    }
+
+    size_t connected_graph_t::sift_layers(std::vector<std::vector<node_t*>>& layer_vec) const
+    {
+        size_t removed = 0;
+        for (size_t iteration = 0; iteration < sifting_iterations; iteration++)
+        {
+            size_t sweep_removed = 0;
+            for (size_t k = 0; k < layer_vec.size(); k++)
+            {
+                auto& layer = layer_vec[iteration % 2 == 0 ? k : layer_vec.size() - 1 - k];
+                if (layer.size() < 2)
+                {
+                    continue;
+                }
+                const auto ends = get_layer_ends(layer);
+                const vector<node_t*> sifted = layer;
+                for (auto n : sifted)
+                {
+                    sweep_removed += sift_node(layer, n, ends);
+                }
+                calculate_pins_index_in_layer(layer);
+            }
+            removed += sweep_removed;
+            if (sweep_removed == 0)
+            {
+                break;
+            }
+        }
+        return removed;
+    }
+
+    std::vector<std::vector<edge_t*>> connected_graph_t::get_blocks() const
+    {
+        vector<vector<edge_t*>> blocks;
+        unordered_map<const node_t*, size_t> indices;
+        indices.reserve(nodes.size());
+        for (size_t i = 0; i < nodes.size(); i++)
+        {
+            indices[nodes[i]] = i;
+        }
+        // Discovery time and lowest discovery time reachable through one back edge, per node index.
+        const size_t unvisited = numeric_limits<size_t>::max();
+        vector<size_t> discovery(nodes.size(), unvisited);
+        vector<size_t> low(nodes.size(), unvisited);
+        struct frame_t
+        {
+            size_t node;
+            const edge_t* parent_edge;
+            size_t next;
+        };
+        vector<frame_t> stack;
+        vector<edge_t*> edge_stack;
+        size_t time = 0;
+        for (size_t root = 0; root < nodes.size(); root++)
+        {
+            if (discovery[root] != unvisited)
+            {
+                continue;
+            }
+            discovery[root] = low[root] = time++;
+            stack.push_back(frame_t{root, nullptr, 0});
+            while (!stack.empty())
+            {
+                frame_t& frame = stack.back();
+                const node_t* n = nodes[frame.node];
+                const size_t degree = n->out_edges.size() + n->in_edges.size();
+                if (frame.next < degree)
+                {
+                    // Out edges first, then in edges. Parallel edges to the parent are back edges, only the one
+                    // the search came through is skipped.
+                    const bool is_out = frame.next < n->out_edges.size();
+                    edge_t* e = is_out ? n->out_edges[frame.next] : n->in_edges[frame.next - n->out_edges.size()];
+                    frame.next++;
+                    if (e == frame.parent_edge)
+                    {
+                        continue;
+                    }
+                    const size_t other = indices[is_out ? e->head->owner : e->tail->owner];
+                    if (discovery[other] == unvisited)
+                    {
+                        edge_stack.push_back(e);
+                        discovery[other] = low[other] = time++;
+                        stack.push_back(frame_t{other, e, 0});
+                    }
+                    else if (discovery[other] < discovery[frame.node])
+                    {
+                        edge_stack.push_back(e);
+                        low[frame.node] = std::min(low[frame.node], discovery[other]);
+                    }
+                    continue;
+                }
+                const frame_t finished = frame;
+                stack.pop_back();
+                if (stack.empty())
+                {
+                    continue;
+                }
+                const size_t parent = stack.back().node;
+                low[parent] = std::min(low[parent], low[finished.node]);
+                if (low[finished.node] >= discovery[parent])
+                {
+                    // Nothing below reaches above the parent, the edges pushed since the tree edge form a block.
+                    vector<edge_t*> block;
+                    edge_t* e;
+                    do
+                    {
+                        e = edge_stack.back();
+                        edge_stack.pop_back();
+                        block.push_back(e);
+                    }
+                    while (e != finished.parent_edge);
+                    blocks.push_back(std::move(block));
+                }
+            }
+        }
+        return blocks;
+    }
+
+    bool connected_graph_t::rank_blocks(rank_stats_t* stats)
+    {
+        const auto start = chrono::steady_clock::now();
+        for (auto [key, e] : edges)
+        {
+            if (e->tail->owner == e->head->owner)
+            {
+                return false;
+            }
+        }
+        const auto blocks = get_blocks();
+        if (blocks.size() < 2)
+        {
+            return false;
+        }
+
+        // A block of one edge ranks itself, the others are copied into graphs of their own.
+        vector<unordered_map<node_t*, int>> block_ranks(blocks.size());
+        vector<rank_stats_t> block_stats(blocks.size());
+        vector<size_t> copied;
+        for (size_t i = 0; i < blocks.size(); i++)
+        {
+            if (blocks[i].size() == 1)
+            {
+                const edge_t* e = blocks[i][0];
+                block_ranks[i][e->tail->owner] = 0;
+                block_ranks[i][e->head->owner] = e->min_length;
+            }
+            else
+            {
+                copied.push_back(i);
+            }
+        }
+        auto rank_block = [&](size_t index)
+        {
+            const size_t i = copied[index];
+            connected_graph_t block;
+            block.is_chain_compression_enabled = is_chain_compression_enabled;
+            block.is_bounded_ranking = is_bounded_ranking;
+            block.max_rank_pivots = max_rank_pivots;
+            block.rank_time_budget_ms = rank_time_budget_ms - elapsed_ms(start);
+            unordered_map<node_t*, node_t*> copies;
+            for (auto e : blocks[i])
+            {
+                node_t*& tail = copies[e->tail->owner];
+                node_t*& head = copies[e->head->owner];
+                tail = tail ? tail : block.add_node();
+                head = head ? head : block.add_node();
+                edge_t* copy = block.add_edge(tail->add_pin(pin_type_t::out), head->add_pin(pin_type_t::in));
+                copy->weight = e->weight;
+                copy->min_length = e->min_length;
+            }
+            if (!block.is_chain_compression_enabled || !block.rank_compressed_chains(&block_stats[i]))
+            {
+                block_stats[i] = block.rank();
+            }
+            for (auto [original, copy] : copies)
+            {
+                block_ranks[i][original] = copy->rank;
+            }
+        };
+        if (thread_pool && copied.size() > 1)
+        {
+            thread_pool->parallel_for(copied.size(), rank_block);
+        }
+        else
+        {
+            for (size_t index = 0; index < copied.size(); index++)
+            {
+                rank_block(index);
+            }
+        }
+
+        // Blocks form a tree through their articulation nodes, each is shifted to where its parent put the node.
+        unordered_map<node_t*, vector<size_t>> node_blocks;
+        for (size_t i = 0; i < blocks.size(); i++)
+        {
+            for (auto [n, rank] : block_ranks[i])
+            {
+                node_blocks[n].push_back(i);
+            }
+        }
+        vector<bool> is_placed(blocks.size(), false);
+        vector<size_t> queue{0};
+        is_placed[0] = true;
+        for (auto [n, rank] : block_ranks[0])
+        {
+            n->rank = rank;
+        }
+        for (size_t q = 0; q < queue.size(); q++)
+        {
+            for (auto [n, rank] : block_ranks[queue[q]])
+            {
+                for (auto next : node_blocks[n])
+                {
+                    if (is_placed[next])
+                    {
+                        continue;
+                    }
+                    is_placed[next] = true;
+                    const int offset = n->rank - block_ranks[next].at(n);
+                    for (auto [other, other_rank] : block_ranks[next])
+                    {
+                        other->rank = other_rank + offset;
+                    }
+                    queue.push_back(next);
+                }
+            }
+        }
+        normalize();
+        if (stats)
+        {
+            for (const auto& block : block_stats)
+            {
+                stats->pivots += block.pivots;
+                stats->is_stopped_early = stats->is_stopped_early || block.is_stopped_early;
+            }
+            measure_lengths(this, *stats);
+            stats->elapsed_ms = elapsed_ms(start);
+        }
+        return true;
+    }
+
+    multilevel_stats_t connected_graph_t::arrange_multilevel()
+    {
+        multilevel_stats_t stats;
+        acyclic_stats = acyclic();
+        vector<unique_ptr<connected_graph_t>> coarse_graphs;
+        vector<unordered_map<const node_t*, node_t*>> parents;
+        vector<connected_graph_t*> levels{this};
+        while (levels.back()->nodes.size() > coarse_target)
+        {
+            unordered_map<const node_t*, node_t*> level_parents;
+            unique_ptr<connected_graph_t> coarse(levels.back()->coarsen(level_parents));
+            if (coarse->nodes.size() * 10 > levels.back()->nodes.size() * 9)
+            {
+                // Mostly stars and isolated matches left, another level wouldn't be much smaller.
+                break;
+            }
+            coarse->acyclic();
+            levels.push_back(coarse.get());
+            coarse_graphs.push_back(std::move(coarse));
+            parents.push_back(std::move(level_parents));
+        }
+        stats.levels = levels.size();
+        stats.coarsest_nodes = levels.back()->nodes.size();
+
+        connected_graph_t* coarsest = levels.back();
+        if (!coarsest->is_chain_compression_enabled || !coarsest->rank_compressed_chains())
+        {
+            coarsest->rank();
+        }
+        coarsest->add_dummy_nodes(nullptr);
+        coarsest->assign_layers();
+        coarsest->ordering();
+
+        for (size_t level = levels.size() - 1; level-- > 0;)
+        {
+            connected_graph_t* graph = levels[level];
+            const auto& level_parents = parents[level];
+            // Merged nodes span two ranks, twice the coarse ranks leave room for both.
+            for (auto n : graph->nodes)
+            {
+                n->rank = level_parents.at(n)->rank;
+            }
+            graph->refine_ranks(refinement_iterations);
+            graph->add_dummy_nodes(nullptr);
+            graph->assign_layers();
+
+            // Nodes start at the place of their merged node in its layer, dummies evenly between the ends of their edge.
+            unordered_map<const node_t*, float> keys;
+            for (const auto& layer : levels[level + 1]->layers)
+            {
+                for (size_t i = 0; i < layer.size(); i++)
+                {
+                    keys[layer[i]] = layer.size() > 1 ? static_cast<float>(i) / static_cast<float>(layer.size() - 1) : 0.5f;
+                }
+            }
+            unordered_map<const node_t*, float> places;
+            for (auto n : graph->nodes)
+            {
+                if (n->is_dummy_node)
+                {
+                    continue;
+                }
+                const float tail_place = keys[level_parents.at(n)];
+                places[n] = tail_place;
+                for (auto e : n->out_edges)
+                {
+                    vector<const node_t*> chain;
+                    const node_t* next = e->head->owner;
+                    while (next->is_dummy_node)
+                    {
+                        chain.push_back(next);
+                        next = next->out_edges[0]->head->owner;
+                    }
+                    const float head_place = keys[level_parents.at(next)];
+                    for (size_t i = 0; i < chain.size(); i++)
+                    {
+                        places[chain[i]] = tail_place + (head_place - tail_place) * static_cast<float>(i + 1) / static_cast<float>(chain.size() + 1);
+                    }
+                }
+            }
+            for (auto& layer : graph->layers)
+            {
+                stable_sort(layer.begin(), layer.end(), [&places](const node_t* a, const node_t* b) { return places[a] < places[b]; });
+            }
+            const size_t max_iterations = graph->max_iterations;
+            graph->max_iterations = refinement_iterations;
+            graph->ordering();
+            graph->max_iterations = max_iterations;
+        }
+        return stats;
+    }
+
+    connected_graph_t* connected_graph_t::coarsen(std::unordered_map<const node_t*, node_t*>& parents) const
+    {
+        auto coarse = new connected_graph_t();
+        coarse->is_chain_compression_enabled = is_chain_compression_enabled;
+        coarse->acyclic_mode = acyclic_mode;
+        coarse->is_edge_bundling_enabled = is_edge_bundling_enabled;
+        coarse->is_bounded_ranking = is_bounded_ranking;
+        coarse->max_rank_pivots = max_rank_pivots;
+        coarse->rank_time_budget_ms = rank_time_budget_ms;
+        for (auto n : nodes)
+        {
+            if (parents.count(n))
+            {
+                continue;
+            }
+            node_t* mate = nullptr;
+            int heaviest = 0;
+            for (auto e : n->out_edges)
+            {
+                if (e->weight > heaviest && !parents.count(e->head->owner))
+                {
+                    mate = e->head->owner;
+                    heaviest = e->weight;
+                }
+            }
+            for (auto e : n->in_edges)
+            {
+                if (e->weight > heaviest && !parents.count(e->tail->owner))
+                {
+                    mate = e->tail->owner;
+                    heaviest = e->weight;
+                }
+            }
+            node_t* parent = coarse->add_node();
+            parent->add_pin(pin_type_t::in);
+            parent->add_pin(pin_type_t::out);
+            parents[n] = parent;
+            if (mate)
+            {
+                parents[mate] = parent;
+            }
+        }
+        for (auto [key, e] : edges)
+        {
+            node_t* tail = parents.at(e->tail->owner);
+            node_t* head = parents.at(e->head->owner);
+            if (tail == head)
+            {
+                continue;
+            }
+            auto it = coarse->edges.find(make_pair(tail->out_pins[0], head->in_pins[0]));
+            if (it == coarse->edges.end())
+            {
+                coarse->add_edge(tail->out_pins[0], head->in_pins[0])->weight = e->weight;
+            }
+            else
+            {
+                it->second->weight += e->weight;
+            }
+        }
+        return coarse;
     }
 
-    void connected_graph_t::ordering()
+    void connected_graph_t::refine_ranks(size_t sweeps) const
     {
-        auto order = layers;
-        auto best = layers;
-        size_t best_crossing = crossing(best, true);
-        for (size_t i = 0; i < max_iterations; i++)
+        unordered_map<const node_t*, size_t> in_degrees;
+        vector<node_t*> sorted;
+        for (auto n : nodes)
         {
-            sort_layers(order, i % 2 == 0);
-            const size_t new_crossing = crossing(order, true);
-            if (new_crossing < best_crossing)
+            in_degrees[n] = n->in_edges.size();
+            if (n->in_edges.empty())
             {
-                best = order;
-                best_crossing = new_crossing;
+                sorted.push_back(n);
             }
         }
-        layers = best;
+        for (size_t i = 0; i < sorted.size(); i++)
+        {
+            node_t* n = sorted[i];
+            for (auto e : n->in_edges)
+            {
+                n->rank = std::max(n->rank, e->tail->owner->rank + e->min_length);
+            }
+            for (auto e : n->out_edges)
+            {
+                if (--in_degrees[e->head->owner] == 0)
+                {
+                    sorted.push_back(e->head->owner);
+                }
+            }
+        }
+        // Between its tails and heads a node costs the weight of its in edges per rank down and of its out edges
+        // per rank up, it goes all the way to the cheaper end. Ties go up so chains close up behind their first node.
+        for (size_t sweep = 0; sweep < sweeps; sweep++)
+        {
+            bool is_moved = false;
+            for (auto n : sorted)
+            {
+                int in_weight = 0;
+                int out_weight = 0;
+                int lowest = numeric_limits<int>::min();
+                int highest = numeric_limits<int>::max();
+                for (auto e : n->in_edges)
+                {
+                    in_weight += e->weight;
+                    lowest = std::max(lowest, e->tail->owner->rank + e->min_length);
+                }
+                for (auto e : n->out_edges)
+                {
+                    out_weight += e->weight;
+                    highest = std::min(highest, e->head->owner->rank - e->min_length);
+                }
+                int rank = n->rank;
+                if (!n->in_edges.empty() && in_weight >= out_weight)
+                {
+                    rank = lowest;
+                }
+                else if (!n->out_edges.empty() && out_weight > in_weight)
+                {
+                    rank = highest;
+                }
+                is_moved = is_moved || rank != n->rank;
+                n->rank = rank;
+            }
+            if (!is_moved)
+            {
+                break;
+            }
+        }
+        normalize();
+    }
+
+    std::unordered_map<const node_t*, float> connected_graph_t::order_layers_by_position()
+    {
+        // Across the layers, centers of real nodes, dummies stay level with the pin their edge starts from.
+        auto across = [this](vector2_t v) { return is_vertical_layout ? v.x : v.y; };
+        unordered_map<const node_t*, float> places;
+        for (auto n : nodes)
+        {
+            if (n->is_dummy_node)
+            {
+                continue;
+            }
+            places[n] = across(n->position + n->size * 0.5f);
+            for (auto e : n->out_edges)
+            {
+                const float start = across(n->position + e->tail->offset);
+                const node_t* next = e->head->owner;
+                while (next->is_dummy_node && next->out_edges.size() == 1)
+                {
+                    places[next] = start;
+                    next = next->out_edges[0]->head->owner;
+                }
+            }
+        }
+        unordered_map<const node_t*, float> anchors;
+        for (auto& layer : layers)
+        {
+            stable_sort(layer.begin(), layer.end(), [&places](const node_t* a, const node_t* b) { return places[a] < places[b]; });
+            for (size_t i = 0; i < layer.size(); i++)
+            {
+                if (!layer[i]->is_dummy_node)
+                {
+                    anchors[layer[i]] = static_cast<float>(i);
+                }
+            }
+        }
+        return anchors;
     }
 
     void connected_graph_t::arrange()
     {
+        resolve_offset();
+        layout_anchor = nullptr;
+        uint64_t layout_key = 0;
+        if (layout_cache && !nodes.empty())
+        {
+            // Unchanged graphs, and unchanged sub graphs of changed ones, take the results of the last layout.
+            layout_key = structural_hash(this);
+            auto layout = layout_cache->find(layout_key);
+            if (layout)
+            {
+                layout_anchor = layout->apply(this);
+                if (layout_anchor)
+                {
+                    return;
+                }
+            }
+        }
+        for (auto [node, graph] : sub_graphs)
+        {
+            if (!graph->thread_pool)
+            {
+                graph->thread_pool = thread_pool;
+            }
+            if (!graph->layout_cache)
+            {
+                graph->layout_cache = layout_cache;
+            }
+            if (!graph->layout_session)
+            {
+                graph->layout_session = layout_session;
+            }
+        }
+        // Sibling sub graphs are independent, each arranges its own children the same way before returning,
+        // so the hierarchy is arranged bottom-up as a fork-join tree. Results don't depend on the schedule.
+        vector<graph_t*> children;
+        for (auto [node, graph] : sub_graphs)
+        {
+            children.push_back(graph);
+        }
+        arrange_graphs(children, thread_pool);
         for (auto [node, graph] : sub_graphs)
         {
-            graph->arrange();
             node->update_pins_offset();
             auto sub_bound = graph->bound;
             node->position = vector2_t{sub_bound.l, sub_bound.t} - vector2_t{graph->border.l, graph->border.t};
@@ -1456,57 +2914,291 @@ namespace graph_layout
         }
         if (!nodes.empty())
         {
-            acyclic();
-            rank();
-            add_dummy_nodes(nullptr);
-            assign_layers();
-            ordering();
-            assign_coordinate();
+            if (!is_tree_layout_enabled || !arrange_tree())
+            {
+                if (multilevel_threshold > 0 && nodes.size() > multilevel_threshold)
+                {
+                    arrange_multilevel();
+                }
+                else if (!layout_session || !layout_session->arrange_incrementally(this))
+                {
+                    acyclic_stats = acyclic();
+                    rank_stats = rank_stats_t{};
+                    rank_seed_t seed;
+                    if (layout_session && layout_session->get_rank_seed(this, seed))
+                    {
+                        // The last layout is close to optimal, network simplex only has to catch up with the edits.
+                        rank_stats = rank(&seed);
+                    }
+                    else if ((!is_block_decomposition_enabled || !rank_blocks(&rank_stats)) && (!is_chain_compression_enabled || !rank_compressed_chains(&rank_stats)))
+                    {
+                        rank_stats = rank();
+                    }
+                    add_dummy_nodes(nullptr);
+                    assign_layers();
+                    ordering();
+                }
+                assign_coordinate();
+            }
+            layout_anchor = layers[0][0];
+            if (layout_session)
+            {
+                layout_session->record(this);
+            }
+            if (layout_cache)
+            {
+                layout_cache->insert(layout_key, cached_layout_t::capture(this, layout_anchor));
+            }
+        }
+    }
+
+    bool connected_graph_t::arrange_tree()
+    {
+        // Every node but the root hangs from one parent, by one or more edges between the two.
+        bool is_out_tree = true;
+        bool is_in_tree = true;
+        size_t out_roots = 0;
+        size_t in_roots = 0;
+        for (auto n : nodes)
+        {
+            const node_t* tail = nullptr;
+            for (auto e : n->in_edges)
+            {
+                if (e->min_length != 1 || e->tail->owner == n)
+                {
+                    return false;
+                }
+                is_out_tree = is_out_tree && (!tail || tail == e->tail->owner);
+                tail = e->tail->owner;
+            }
+            const node_t* head = nullptr;
+            for (auto e : n->out_edges)
+            {
+                is_in_tree = is_in_tree && (!head || head == e->head->owner);
+                head = e->head->owner;
+            }
+            out_roots += tail ? 0 : 1;
+            in_roots += head ? 0 : 1;
+        }
+        is_out_tree = is_out_tree && out_roots == 1;
+        is_in_tree = is_in_tree && in_roots == 1;
+        if (!is_out_tree && !is_in_tree)
+        {
+            return false;
+        }
+
+        // Ranks grow away from the root when the edges point away from it. A node hangs from its parent by the
+        // edge with the first pin of the parent, children are in the order of those pins.
+        const bool is_down = is_out_tree;
+        unordered_map<const node_t*, size_t> indices;
+        indices.reserve(nodes.size());
+        for (size_t i = 0; i < nodes.size(); i++)
+        {
+            indices[nodes[i]] = i;
+        }
+        vector<edge_t*> links(nodes.size(), nullptr);
+        vector<vector<node_t*>> children(nodes.size());
+        node_t* root = nullptr;
+        for (auto n : nodes)
+        {
+            edge_t* link = nullptr;
+            for (auto e : is_down ? n->in_edges : n->out_edges)
+            {
+                const pin_t* pin = is_down ? e->tail : e->head;
+                if (!link || pin->id < (is_down ? link->tail : link->head)->id)
+                {
+                    link = e;
+                }
+            }
+            if (!link)
+            {
+                root = n;
+                continue;
+            }
+            links[indices[n]] = link;
+            children[indices[is_down ? link->tail->owner : link->head->owner]].push_back(n);
+        }
+        for (auto& list : children)
+        {
+            stable_sort(list.begin(), list.end(), [&](const node_t* a, const node_t* b)
+            {
+                const edge_t* a_link = links[indices[a]];
+                const edge_t* b_link = links[indices[b]];
+                return (is_down ? a_link->tail : a_link->head)->id < (is_down ? b_link->tail : b_link->head)->id;
+            });
+        }
+        vector<node_t*> order{root};
+        order.reserve(nodes.size());
+        root->rank = 0;
+        int min_rank = 0;
+        for (size_t i = 0; i < order.size(); i++)
+        {
+            for (auto child : children[indices[order[i]]])
+            {
+                child->rank = order[i]->rank + (is_down ? 1 : -1);
+                min_rank = std::min(min_rank, child->rank);
+                order.push_back(child);
+            }
+        }
+
+        // Subtrees bottom-up, each placed right of its left siblings as close as the contours of both allow, the
+        // parent between the pins of its first and last child. Contours keep the extent across of every level,
+        // deepest first, relative to offset. Merging costs the height of the lower one, linear time in total.
+        struct contour_t
+        {
+            vector<pair<float, float>> levels;
+            float offset = 0;
+        };
+        auto across = [this](vector2_t v) { return is_vertical_layout ? v.x : v.y; };
+        const float gap = is_vertical_layout ? layer_node_gap.x : layer_node_gap.y;
+        vector<contour_t> contours(nodes.size());
+        // Left side of a node across, relative to the one of its parent.
+        vector<float> relative(nodes.size(), 0);
+        vector<float> places;
+        for (size_t i = order.size(); i-- > 0;)
+        {
+            const node_t* n = order[i];
+            const auto& list = children[indices[n]];
+            contour_t contour;
+            if (!list.empty())
+            {
+                places.assign(list.size(), 0);
+                contour = std::move(contours[indices[list[0]]]);
+                for (size_t k = 1; k < list.size(); k++)
+                {
+                    contour_t& next = contours[indices[list[k]]];
+                    const size_t common = std::min(contour.levels.size(), next.levels.size());
+                    float shift = -FLT_MAX;
+                    for (size_t t = 1; t <= common; t++)
+                    {
+                        const auto& left = contour.levels[contour.levels.size() - t];
+                        const auto& right = next.levels[next.levels.size() - t];
+                        shift = std::max(shift, left.second + contour.offset - right.first - next.offset + gap);
+                    }
+                    next.offset += shift;
+                    places[k] = shift;
+                    if (next.levels.size() > contour.levels.size())
+                    {
+                        for (size_t t = 1; t <= common; t++)
+                        {
+                            next.levels[next.levels.size() - t].first = contour.levels[contour.levels.size() - t].first + contour.offset - next.offset;
+                        }
+                        swap(contour, next);
+                    }
+                    else
+                    {
+                        for (size_t t = 1; t <= common; t++)
+                        {
+                            contour.levels[contour.levels.size() - t].second = next.levels[next.levels.size() - t].second + next.offset - contour.offset;
+                        }
+                    }
+                    next.levels = {};
+                }
+                auto aligned = [&](size_t k)
+                {
+                    const edge_t* link = links[indices[list[k]]];
+                    const pin_t* child_pin = is_down ? link->head : link->tail;
+                    const pin_t* parent_pin = is_down ? link->tail : link->head;
+                    return places[k] + across(child_pin->offset) - across(parent_pin->offset);
+                };
+                const float left = (aligned(0) + aligned(list.size() - 1)) / 2;
+                for (size_t k = 0; k < list.size(); k++)
+                {
+                    relative[indices[list[k]]] = places[k] - left;
+                }
+                contour.offset -= left;
+            }
+            const float size = across(n->size);
+            contour.levels.emplace_back(-contour.offset, size - contour.offset);
+            contours[indices[n]] = std::move(contour);
+        }
+        contours = {};
+        for (size_t i = 1; i < order.size(); i++)
+        {
+            const node_t* n = order[i];
+            const edge_t* link = links[indices[n]];
+            relative[indices[n]] += relative[indices[is_down ? link->tail->owner : link->head->owner]];
+        }
+
+        // Each level is one layer, already in order from left to right.
+        int max_rank = 0;
+        for (auto n : order)
+        {
+            n->rank -= min_rank;
+            max_rank = std::max(max_rank, n->rank);
+        }
+        layers.assign(max_rank + 1, {});
+        for (auto n : order)
+        {
+            layers[n->rank].push_back(n);
+        }
+
+        // Along the ranks nodes line up the way assign_coordinate() lines them up, the first node keeps its position.
+        const auto layers_bound = get_layers_bound();
+        vector<vector2_t> positions(nodes.size());
+        for (auto n : order)
+        {
+            const rect_t& layer_bound = layers_bound[n->rank];
+            const float cross = relative[indices[n]];
+            if (is_vertical_layout)
+            {
+                positions[indices[n]] = vector2_t{cross, n->in_edges.empty() ? layer_bound.b - n->size.y : layer_bound.t};
+            }
+            else
+            {
+                positions[indices[n]] = vector2_t{n->in_edges.empty() ? layer_bound.r - n->size.x : layer_bound.l, cross};
+            }
+        }
+        node_t* first_node = layers[0][0];
+        const vector2_t offset = first_node->position - positions[indices[first_node]];
+        bound = rect_t{first_node->position.x, first_node->position.y, first_node->position.x, first_node->position.y};
+        for (auto n : nodes)
+        {
+            n->set_position(positions[indices[n]] + offset);
+            bound = bound.expand(n->position, n->size);
         }
+        return true;
     }
 
     void connected_graph_t::assign_coordinate()
     {
         auto layers_bound = get_layers_bound();
         fas_positioning_strategy_t positioning_strategy{layers, !is_vertical_layout, layers_bound};
-        positioning_strategy.assign_coordinate();
+        bound = positioning_strategy.assign_coordinate();
     }
 
-    std::map<pin_t*, vector2_t> connected_graph_t::get_pins_offset()
+    void connected_graph_t::visit_pins_offset(const std::function<void(pin_t*, vector2_t)>& visitor, vector2_t origin)
     {
-        map<pin_t*, vector2_t> result;
+        resolve_offset();
+        const vector2_t corner = vector2_t{bound.l, bound.t} - origin;
         for (auto n : nodes)
         {
             for (auto pin : n->out_pins)
             {
-                vector2_t offset = n->position + pin->offset - vector2_t{bound.t, bound.l};
-                result[pin] = offset;
+                visitor(pin, n->position + pin->offset - corner);
             }
             for (auto pin : n->in_pins)
             {
-                vector2_t offset = n->position + pin->offset - vector2_t{bound.t, bound.l};
-                result[pin] = offset;
+                visitor(pin, n->position + pin->offset - corner);
             }
         }
-        return result;
     }
 
-    std::map<node_t*, rect_t> connected_graph_t::get_bounds()
+    void connected_graph_t::visit_bounds(const std::function<void(node_t*, const rect_t&)>& visitor)
     {
-        std::map<node_t*, rect_t> result;
+        // Sub graphs resolve what this level hands down when they are visited in turn.
+        resolve_offset();
         for (auto n : nodes)
         {
             if (n->is_dummy_node) continue;
             float right = n->position.x + n->size.x;
             float bottom = n->position.y + n->size.y;
-            result[n] = rect_t{n->position.x, n->position.y, right, bottom};
+            visitor(n, rect_t{n->position.x, n->position.y, right, bottom});
             if (n->graph)
             {
-                auto sub_bounds = n->graph->get_bounds();
-                std::copy(sub_bounds.begin(), sub_bounds.end(), std::inserter(result, result.end()));
+                n->graph->visit_bounds(visitor);
             }
         }
-        return result;
     }
 
     std::vector<rect_t> connected_graph_t::get_layers_bound() const
@@ -1527,7 +3219,7 @@ namespace graph_layout
         return layers_bound;
     }
 
-    void connected_graph_t::sort_layers(std::vector<std::vector<node_t*>>& layer_vec, bool is_down) const
+    void connected_graph_t::sort_layers(std::vector<std::vector<node_t*>>& layer_vec, bool is_down, const std::unordered_map<const node_t*, float>* anchors) const
     {
         int max_rank = static_cast<int>(layer_vec.size());
         if (max_rank < 2)
@@ -1548,11 +3240,58 @@ namespace graph_layout
             {
                 n->layer_order = n->get_barycenter_in_layer(fixed_layer, is_down);
             }
-            stable_sort(free_layer.begin(), free_layer.end(), [](node_t* a, node_t* b)
+            if (anchors)
             {
-                if (a->layer_order == -1.0f || b->layer_order == -1.0f) return false;
-                return a->layer_order < b->layer_order;
-            });
+                // Kept in their starting order, the anchored nodes would take their own barycenters in ascending
+                // order, those are what they are pulled to. Dummies and new nodes go where the barycenters put them,
+                // anchored nodes without a barycenter stay next to the one before them.
+                vector<pair<float, node_t*>> anchored;
+                vector<float> kept_orders;
+                for (auto n : free_layer)
+                {
+                    auto it = anchors->find(n);
+                    if (it != anchors->end())
+                    {
+                        anchored.emplace_back(it->second, n);
+                        if (n->layer_order != -1.0f)
+                        {
+                            kept_orders.push_back(n->layer_order);
+                        }
+                    }
+                }
+                sort(anchored.begin(), anchored.end(), [](const pair<float, node_t*>& a, const pair<float, node_t*>& b) { return a.first < b.first; });
+                sort(kept_orders.begin(), kept_orders.end());
+                size_t k = 0;
+                float previous = kept_orders.empty() ? 0.0f : kept_orders[0];
+                for (auto [anchor, n] : anchored)
+                {
+                    if (n->layer_order != -1.0f)
+                    {
+                        n->layer_order = n->layer_order * (1.0f - movement_penalty) + kept_orders[k++] * movement_penalty;
+                    }
+                    else
+                    {
+                        n->layer_order = previous;
+                    }
+                    previous = n->layer_order;
+                }
+                stable_sort(free_layer.begin(), free_layer.end(), [anchors](node_t* a, node_t* b)
+                {
+                    if (a->layer_order == -1.0f || b->layer_order == -1.0f) return false;
+                    if (a->layer_order != b->layer_order) return a->layer_order < b->layer_order;
+                    auto a_it = anchors->find(a);
+                    auto b_it = anchors->find(b);
+                    return a_it != anchors->end() && b_it != anchors->end() && a_it->second < b_it->second;
+                });
+            }
+            else
+            {
+                stable_sort(free_layer.begin(), free_layer.end(), [](node_t* a, node_t* b)
+                {
+                    if (a->layer_order == -1.0f || b->layer_order == -1.0f) return false;
+                    return a->layer_order < b->layer_order;
+                });
+            }
             calculate_pins_index_in_layer(free_layer);
             i += step;
         }
@@ -1599,6 +3338,23 @@ namespace graph_layout
         return result;
     }
 
+    // Pairs of edges between two layers that cross each other. Pin indices must be up to date.
+    static size_t count_edge_crossings(const vector<edge_t*>& edges)
+    {
+        size_t count = 0;
+        for (size_t i = 0; i < edges.size(); i++)
+        {
+            for (size_t j = i + 1; j < edges.size(); j++)
+            {
+                if (edges[i]->is_crossing(edges[j]))
+                {
+                    count++;
+                }
+            }
+        }
+        return count;
+    }
+
     size_t connected_graph_t::crossing(const vector<vector<node_t*>>& order, bool calculate_pins_index)
     {
         size_t crossing_value = 0;
@@ -1613,35 +3369,73 @@ namespace graph_layout
         {
             auto& upper_layer = order[i - 1];
             auto& lower_layer = order[i];
-            auto cross_edges = get_edges_between_two_layers(lower_layer, upper_layer);
-            while (!cross_edges.empty())
+            crossing_value += count_edge_crossings(get_edges_between_two_layers(lower_layer, upper_layer));
+        }
+        return crossing_value;
+    }
+
+    bool crossing_estimate_t::is_fewer_than(const crossing_estimate_t& other) const
+    {
+        return value + 2 * sqrt(variance + other.variance) < other.value;
+    }
+
+    crossing_estimate_t connected_graph_t::estimate_crossing(const vector<vector<node_t*>>& order, size_t sample_size)
+    {
+        if (sample_size == 0)
+        {
+            return crossing_estimate_t{static_cast<double>(crossing(order, true)), 0};
+        }
+        for (auto& layer : order)
+        {
+            calculate_pins_index_in_layer(layer);
+        }
+        crossing_estimate_t estimate;
+        // Engine output is fixed by the standard for a seed, distributions are not, so indices are taken modulo.
+        mt19937_64 random(sample_size);
+        for (size_t i = 1; i < order.size(); i++)
+        {
+            const auto edges = get_edges_between_two_layers(order[i], order[i - 1]);
+            const double pairs = edges.size() * (edges.size() - 1) / 2.0;
+            if (pairs <= sample_size)
             {
-                auto edge1 = cross_edges.back();
-                cross_edges.pop_back();
-                for (auto edge2 : cross_edges)
-                {
-                    if (edge1->is_crossing(edge2))
-                    {
-                        crossing_value++;
-                    }
-                }
+                estimate.value += count_edge_crossings(edges);
+                continue;
+            }
+            size_t hits = 0;
+            for (size_t k = 0; k < sample_size; k++)
+            {
+                const size_t a = random() % edges.size();
+                size_t b = random() % (edges.size() - 1);
+                b += b >= a ? 1 : 0;
+                hits += edges[a]->is_crossing(edges[b]) ? 1 : 0;
             }
+            // The variance takes the rate as if one more pair of each kind was drawn, so no hits isn't certainty.
+            const double rate = static_cast<double>(hits) / sample_size;
+            const double smoothed = (hits + 1.0) / (sample_size + 2.0);
+            estimate.value += pairs * rate;
+            estimate.variance += pairs * pairs * smoothed * (1 - smoothed) / sample_size;
         }
-        return crossing_value;
+        return estimate;
     }
 
-    tree_t connected_graph_t::feasible_tree() const
+    tree_t connected_graph_t::feasible_tree(const std::function<bool()>& is_out_of_time) const
     {
         init_rank();
+        return grow_feasible_tree(is_out_of_time);
+    }
+
+    tree_t connected_graph_t::grow_feasible_tree(const std::function<bool()>& is_out_of_time) const
+    {
         for (;;)
         {
             tree_t tree = tight_tree();
-            if (tree.nodes.size() == nodes.size())
+            // Moving a tight tree by the slack of an incident edge keeps every edge long enough, so it can stop anywhere.
+            if (tree.nodes.size() == nodes.size() || (is_out_of_time && is_out_of_time()))
             {
                 return tree;
             }
             node_t* incident_node;
-            edge_t* e = tree.find_min_incident_edge(&incident_node);
+            edge_t* e = tree.find_min_incident_edge(tree.non_tree_edges, &incident_node);
             auto delta = e->slack();
             if (e->head->owner == incident_node)
             {
@@ -1713,24 +3507,29 @@ namespace graph_layout
 
     void connected_graph_t::init_rank() const
     {
-        set<edge_t*> scanned_set;
-        int ranking = 0;
-        set<node_t*> visited_set;
-        while (visited_set.size() != nodes.size())
+        // Longest path from the sources in topological order, every edge at least as long as its minimum length.
+        unordered_map<const node_t*, size_t> in_degrees;
+        vector<node_t*> sorted;
+        for (auto n : nodes)
+        {
+            n->rank = 0;
+            in_degrees[n] = n->in_edges.size();
+            if (n->in_edges.empty())
+            {
+                sorted.push_back(n);
+            }
+        }
+        for (size_t i = 0; i < sorted.size(); i++)
         {
-            auto queue = get_nodes_without_unscanned_in_edges(visited_set, scanned_set);
-            while (!queue.empty())
+            for (auto e : sorted[i]->out_edges)
             {
-                auto n = queue.back();
-                n->rank = ranking;
-                visited_set.insert(n);
-                for (auto e : n->out_edges)
+                node_t* head = e->head->owner;
+                head->rank = std::max(head->rank, sorted[i]->rank + e->min_length);
+                if (--in_degrees[head] == 0)
                 {
-                    scanned_set.insert(e);
+                    sorted.push_back(head);
                 }
-                queue.pop_back();
             }
-            ranking++;
         }
     }
 
@@ -1796,21 +3595,16 @@ namespace graph_layout
                 }
             }
         }
-        set<edge_t*> all_edges;
-        for (auto [fst, edge] : edges)
-        {
-            all_edges.insert(edge);
-        }
-        tree.update_non_tree_edges(all_edges);
+        tree.update_non_tree_edges(edges);
         return tree;
     }
 
-    edge_t* tree_t::find_min_incident_edge(node_t** incident_node)
+    edge_t* tree_t::find_min_incident_edge(const edge_set_t& candidates, node_t** incident_node) const
     {
         edge_t* min_slack_edge = nullptr;
         int slack = std::numeric_limits<int>::max();
         *incident_node = nullptr;
-        for (auto e : non_tree_edges)
+        for (auto e : candidates)
         {
             bool head_is_tree_node = nodes.find(e->head->owner) != nodes.end();
             bool tail_is_tree_node = nodes.find(e->tail->owner) != nodes.end();
@@ -1836,8 +3630,9 @@ namespace graph_layout
             {
                 return;
             }
+            // The edges of this tree that the sub tree doesn't hold are the only ones that can leave it.
             node_t* incident_node;
-            edge_t* e = tree.find_min_incident_edge(&incident_node);
+            edge_t* e = tree.find_min_incident_edge(tree_edges, &incident_node);
             auto delta = e->slack();
             if (e->head->owner == incident_node)
             {
@@ -1885,7 +3680,6 @@ namespace graph_layout
                 }
             }
         }
-        tree.update_non_tree_edges(tree_edges);
         return tree;
     }
 
@@ -1933,29 +3727,111 @@ namespace graph_layout
 
     void tree_t::calculate_cut_values()
     {
-        set<node_t*> visited_nodes;
+        // Tree edges hold every tight edge and may close cycles. Cutting an edge on a cycle leaves one side, where
+        // every other edge counts both ways, so its cut value is its weight. A bridge splits off the subtree below
+        // it in a depth first search, and edges inside either side count both ways again, so its cut value is the
+        // weight leaving minus the weight entering that subtree, summed over its nodes. One pass over the edges
+        // instead of splitting the tree at every edge.
+        unordered_map<const node_t*, vector<edge_t*>> adjacent;
         for (auto edge : tree_edges)
         {
-            split_to_head_tail(edge);
-            int head_to_tail_weight = 0;
-            int tail_to_head_weight = 0;
-            for (auto edge2 : tree_edges)
+            adjacent[edge->tail->owner].push_back(edge);
+            adjacent[edge->head->owner].push_back(edge);
+        }
+        struct visit_t
+        {
+            size_t discovered = 0;
+            size_t low = 0;
+            size_t component = 0;
+            int balance = 0;
+        };
+        unordered_map<const node_t*, visit_t> visits;
+        struct frame_t
+        {
+            node_t* node;
+            edge_t* parent_edge;
+            size_t next;
+        };
+        vector<pair<node_t*, edge_t*>> finished;
+        for (auto root_edge : tree_edges)
+        {
+            node_t* root = root_edge->tail->owner;
+            if (visits.count(root))
+            {
+                continue;
+            }
+            const size_t component = visits.size() + 1;
+            visits[root] = visit_t{component, component, component, 0};
+            vector<frame_t> stack{{root, nullptr, 0}};
+            while (!stack.empty())
             {
-                if (edge2 == edge)
+                frame_t& frame = stack.back();
+                const auto& edges = adjacent[frame.node];
+                if (frame.next == edges.size())
                 {
+                    finished.emplace_back(frame.node, frame.parent_edge);
+                    stack.pop_back();
+                    if (!stack.empty())
+                    {
+                        auto& parent = visits[stack.back().node];
+                        parent.low = std::min(parent.low, visits[finished.back().first].low);
+                    }
                     continue;
                 }
-                add_to_weights(edge2, head_to_tail_weight, tail_to_head_weight);
-            }
-            for (auto edge2 : non_tree_edges)
-            {
-                if (edge2 == edge)
+                edge_t* edge = edges[frame.next++];
+                if (edge == frame.parent_edge)
+                {
+                    continue;
+                }
+                node_t* next = edge->tail->owner == frame.node ? edge->head->owner : edge->tail->owner;
+                auto it = visits.find(next);
+                if (it != visits.end())
                 {
+                    auto& visit = visits[frame.node];
+                    visit.low = std::min(visit.low, it->second.discovered);
                     continue;
                 }
-                add_to_weights(edge2, head_to_tail_weight, tail_to_head_weight);
+                const size_t discovered = visits.size() + 1;
+                visits[next] = visit_t{discovered, discovered, component, 0};
+                stack.push_back(frame_t{next, edge, 0});
+            }
+        }
+
+        // Edges to another part of the tree are on neither side of any cut.
+        auto add_balance = [&visits](const edge_t* edge)
+        {
+            auto tail = visits.find(edge->tail->owner);
+            auto head = visits.find(edge->head->owner);
+            if (tail != visits.end() && head != visits.end() && tail->second.component == head->second.component)
+            {
+                tail->second.balance += edge->weight;
+                head->second.balance -= edge->weight;
+            }
+        };
+        for (auto edge : tree_edges)
+        {
+            edge->cut_value = edge->weight;
+            add_balance(edge);
+        }
+        for (auto edge : non_tree_edges)
+        {
+            add_balance(edge);
+        }
+        // Children finish before their parents.
+        for (auto [n, edge] : finished)
+        {
+            if (!edge)
+            {
+                continue;
+            }
+            const auto& visit = visits[n];
+            node_t* parent = edge->tail->owner == n ? edge->head->owner : edge->tail->owner;
+            auto& parent_visit = visits[parent];
+            if (visit.low > parent_visit.discovered)
+            {
+                edge->cut_value = edge->tail->owner == n ? visit.balance : -visit.balance;
             }
-            edge->cut_value = edge->weight + tail_to_head_weight - head_to_tail_weight;
+            parent_visit.balance += visit.balance;
         }
     }
 
@@ -2011,6 +3887,24 @@ namespace graph_layout
         }
     }
 
+    int tree_t::cut_value_by_split(edge_t* edge)
+    {
+        split_to_head_tail(edge);
+        int head_to_tail_weight = 0;
+        int tail_to_head_weight = 0;
+        for (auto edges : {&tree_edges, &non_tree_edges})
+        {
+            for (auto other : *edges)
+            {
+                if (other != edge)
+                {
+                    add_to_weights(other, head_to_tail_weight, tail_to_head_weight);
+                }
+            }
+        }
+        return edge->weight + tail_to_head_weight - head_to_tail_weight;
+    }
+
     void tree_t::add_to_weights(const edge_t* edge, int& head_to_tail_weight, int& tail_to_head_weight)
     {
         auto tail = edge->tail->owner;
@@ -2029,8 +3923,17 @@ namespace graph_layout
     {
     }
 
-    graph_t::~graph_t()
+    graph_t::graph_t(graph_t&& other) noexcept
     {
+        *this = std::move(other);
+    }
+
+    graph_t& graph_t::operator=(graph_t&& other) noexcept
+    {
+        if (this == &other)
+        {
+            return *this;
+        }
         for (auto [k, edge] : edges)
         {
             delete edge;
@@ -2039,62 +3942,64 @@ namespace graph_layout
         {
             delete n;
         }
+        bound = other.bound;
+        border = other.border;
+        pending_offset = other.pending_offset;
+        other.pending_offset = vector2_t{0, 0};
+        nodes = std::move(other.nodes);
+        edges = std::move(other.edges);
+        sub_graphs = std::move(other.sub_graphs);
+        user_ptr_to_pin = std::move(other.user_ptr_to_pin);
+        spacing = other.spacing;
+        is_vertical_layout = other.is_vertical_layout;
+        thread_pool = other.thread_pool;
+        layout_cache = other.layout_cache;
+        layout_session = other.layout_session;
+        next_id = other.next_id;
+        other.nodes.clear();
+        other.edges.clear();
+        other.sub_graphs.clear();
+        other.user_ptr_to_pin.clear();
+        return *this;
     }
 
-    void tree_t::update_non_tree_edges(const set<edge_t*>& all_edges)
+    graph_t::~graph_t()
     {
-        non_tree_edges.clear();
-        for (auto edge : all_edges)
+        for (auto [k, edge] : edges)
         {
-            if (tree_edges.find(edge) == tree_edges.end())
-            {
-                non_tree_edges.insert(edge);
-            }
+            delete edge;
+        }
+        for (auto n : nodes)
+        {
+            delete n;
         }
     }
 
-    vector<node_t*> connected_graph_t::get_nodes_without_unscanned_in_edges(const set<node_t*>& visited, const set<edge_t*>& scanned_set) const
+    void tree_t::update_non_tree_edges(const std::map<std::pair<pin_t*, pin_t*>, edge_t*, creation_order_t>& edges)
     {
-        vector<node_t*> result;
-        for (auto n : nodes)
+        non_tree_edges.clear();
+        for (auto [key, edge] : edges)
         {
-            if (visited.find(n) != visited.end())
-            {
-                continue;
-            }
-            bool is_all_scanned = true;
-            for (auto e : n->in_edges)
-            {
-                if (scanned_set.find(e) == scanned_set.end())
-                {
-                    is_all_scanned = false;
-                    break;
-                }
-            }
-            if (is_all_scanned)
+            if (tree_edges.find(edge) == tree_edges.end())
             {
-                result.push_back(n);
+                non_tree_edges.insert(edge);
             }
         }
-        return result;
     }
 
-    std::set<void*> connected_graph_t::get_user_pointers()
+    void connected_graph_t::visit_user_pointers(const std::function<void(void*)>& visitor) const
     {
-        std::set<void*> result;
         for (auto node : nodes)
         {
             if (node->graph)
             {
-                auto user_pointers = node->graph->get_user_pointers();
-                std::copy(user_pointers.begin(), user_pointers.end(), std::inserter(result, result.end()));
+                node->graph->visit_user_pointers(visitor);
             }
             if (node->user_ptr != nullptr)
             {
-                result.insert(node->user_ptr);
+                visitor(node->user_ptr);
             }
         }
-        return result;
     }
 
     void connected_graph_t::test()
@@ -2172,5 +4077,533 @@ namespace graph_layout
         g.add_dummy_nodes(nullptr);
         g.assign_layers();
         g.ordering();
+
+        // A moved from graph is left empty, including the offset it still owed its nodes.
+        graph_t moved;
+        moved.add_node("moved");
+        moved.pending_offset = vector2_t{10, 20};
+        graph_t target(std::move(moved));
+        assert(target.nodes.size() == 1 && target.pending_offset.x == 10);
+        assert(moved.nodes.empty() && moved.edges.empty() && moved.pending_offset.x == 0 && moved.pending_offset.y == 0);
+
+        // The tidy tree pass separates layers and neighbours like the layered pipeline does.
+        auto arrange_fork = [](bool is_tree_layout_enabled)
+        {
+            auto fork = new connected_graph_t;
+            fork->spacing = vector2_t{30, 30};
+            fork->is_tree_layout_enabled = is_tree_layout_enabled;
+            auto root = fork->add_node("root");
+            for (auto name : {"left", "right"})
+            {
+                fork->add_edge(root->add_pin(pin_type_t::out), fork->add_node(name)->add_pin(pin_type_t::in));
+            }
+            fork->arrange();
+            return fork;
+        };
+        auto tree_fork = arrange_fork(true);
+        auto layered_fork = arrange_fork(false);
+        const auto tree_nodes = tree_fork->nodes;
+        assert(tree_nodes[1]->position.x - tree_nodes[0]->position.x == layered_fork->nodes[1]->position.x - layered_fork->nodes[0]->position.x);
+        assert(tree_nodes[2]->position.y - tree_nodes[1]->position.y == tree_nodes[1]->size.y + layer_node_gap.y);
+        delete tree_fork;
+        delete layered_fork;
+
+        // Every node hangs from an earlier one, so the graph is connected, and gets a few more in edges.
+        mt19937 random(46);
+        auto add_random_edge = [&random](connected_graph_t& dag, int head)
+        {
+            node_t* tail = dag.nodes[random() % head];
+            auto edge = dag.add_edge(tail->add_pin(pin_type_t::out), dag.nodes[head]->add_pin(pin_type_t::in));
+            edge->weight = static_cast<int>(random() % 4);
+        };
+        auto build_random_dag = [&random, &add_random_edge](connected_graph_t& dag, int node_count)
+        {
+            for (int i = 0; i < node_count; i++)
+            {
+                dag.add_node();
+            }
+            for (int i = 1; i < node_count; i++)
+            {
+                for (int in_edges = 1 + static_cast<int>(random() % 3); in_edges > 0; in_edges--)
+                {
+                    add_random_edge(dag, i);
+                }
+            }
+        };
+
+        // Cut values in one pass match splitting the tree at every edge, also when tight edges close cycles.
+        for (int round = 0; round < 8; round++)
+        {
+            connected_graph_t dag;
+            build_random_dag(dag, 24);
+            tree_t tree = dag.feasible_tree();
+            assert(tree.nodes.size() == dag.nodes.size());
+            tree.calculate_cut_values();
+            for (auto edge : tree.tree_edges)
+            {
+                assert(edge->cut_value == tree.cut_value_by_split(edge));
+            }
+        }
+
+        // Starting from the ranks and spanning tree of the last run takes fewer pivots than a cold run of the edited
+        // graph. A cold run keeps every tight edge in its tree and can stop short of the optimum, which a seeded run
+        // then goes on from, so the seeded result is never worse.
+        size_t warm_pivots = 0;
+        size_t cold_pivots = 0;
+        for (int round = 0; round < 4; round++)
+        {
+            connected_graph_t dag;
+            build_random_dag(dag, 80);
+            rank_seed_t seed;
+            const rank_stats_t first = dag.rank(nullptr, &seed);
+            const rank_stats_t unchanged = dag.rank(&seed);
+            assert(unchanged.is_seed_tree_used && unchanged.repaired_edges == 0);
+            assert(unchanged.weighted_length <= first.weighted_length);
+            for (int i = 0; i < 5; i++)
+            {
+                add_random_edge(dag, 1 + static_cast<int>(random() % 79));
+            }
+            const rank_stats_t warm = dag.rank(&seed);
+            const rank_stats_t cold = dag.rank();
+            assert(warm.weighted_length <= cold.weighted_length);
+            warm_pivots += warm.pivots;
+            cold_pivots += cold.pivots;
+        }
+        assert(warm_pivots < cold_pivots);
+
+        // Ranking chains as single edges ends at the same weighted length as ranking every node, and every edge
+        // keeps its minimum length.
+        for (int round = 0; round < 6; round++)
+        {
+            connected_graph_t chained;
+            for (int i = 0; i < 30; i++)
+            {
+                chained.add_node();
+            }
+            auto link = [&chained, &random](node_t* tail, node_t* head)
+            {
+                chained.add_edge(tail->add_pin(pin_type_t::out), head->add_pin(pin_type_t::in))->weight = 1 + static_cast<int>(random() % 3);
+            };
+            for (int i = 1; i < 30; i++)
+            {
+                for (int in_edges = 1 + static_cast<int>(random() % 2); in_edges > 0; in_edges--)
+                {
+                    node_t* tail = chained.nodes[random() % i];
+                    for (int inner = static_cast<int>(random() % 4); inner > 0; inner--)
+                    {
+                        node_t* next = chained.add_node();
+                        link(tail, next);
+                        tail = next;
+                    }
+                    link(tail, chained.nodes[i]);
+                }
+            }
+            rank_stats_t compressed;
+            assert(chained.rank_compressed_chains(&compressed));
+            for (auto& [key, e] : chained.edges)
+            {
+                assert(e->length() >= e->min_length);
+            }
+            assert(compressed.weighted_length == chained.rank().weighted_length);
+        }
+
+        // A large graph is laid out through coarser levels, ranks stay feasible and no two nodes overlap.
+        connected_graph_t coarsened;
+        build_random_dag(coarsened, 400);
+        coarsened.coarse_target = 60;
+        const multilevel_stats_t multilevel = coarsened.arrange_multilevel();
+        assert(multilevel.levels > 2 && multilevel.coarsest_nodes < 400);
+        for (auto& [key, e] : coarsened.edges)
+        {
+            assert(e->length() >= e->min_length);
+        }
+        size_t layered_count = 0;
+        for (size_t i = 0; i < coarsened.layers.size(); i++)
+        {
+            for (auto n : coarsened.layers[i])
+            {
+                assert(n->rank == static_cast<int>(i));
+                layered_count++;
+            }
+        }
+        assert(layered_count == coarsened.nodes.size());
+        coarsened.assign_coordinate();
+        for (size_t i = 0; i < coarsened.nodes.size(); i++)
+        {
+            for (size_t j = i + 1; j < coarsened.nodes.size(); j++)
+            {
+                const node_t* a = coarsened.nodes[i];
+                const node_t* b = coarsened.nodes[j];
+                const bool is_apart_x = a->position.x + a->size.x <= b->position.x || b->position.x + b->size.x <= a->position.x;
+                const bool is_apart_y = a->position.y + a->size.y <= b->position.y || b->position.y + b->size.y <= a->position.y;
+                assert(a->is_dummy_node || b->is_dummy_node || is_apart_x || is_apart_y);
+            }
+        }
+
+        // Two triangles sharing a node and an edge hanging from the second are three blocks.
+        connected_graph_t bowtie;
+        for (int i = 0; i < 6; i++)
+        {
+            bowtie.add_node();
+        }
+        for (auto [tail, head] : vector<pair<int, int>>{{0, 1}, {1, 2}, {0, 2}, {2, 3}, {3, 4}, {2, 4}, {4, 5}})
+        {
+            bowtie.add_edge(bowtie.nodes[tail]->add_pin(pin_type_t::out), bowtie.nodes[head]->add_pin(pin_type_t::in));
+        }
+        vector<size_t> block_sizes;
+        for (const auto& block : bowtie.get_blocks())
+        {
+            block_sizes.push_back(block.size());
+        }
+        sort(block_sizes.begin(), block_sizes.end());
+        assert((block_sizes == vector<size_t>{1, 3, 3}));
+
+        // Blocks glued at articulation nodes rank to the same weighted length as the whole graph, on a thread pool
+        // or not.
+        thread_pool_t block_pool(4);
+        for (int round = 0; round < 6; round++)
+        {
+            connected_graph_t glued;
+            glued.add_node();
+            for (int block = 0; block < 6; block++)
+            {
+                vector<node_t*> block_nodes{glued.nodes[random() % glued.nodes.size()]};
+                for (int i = 1; i < 6; i++)
+                {
+                    block_nodes.push_back(glued.add_node());
+                    for (int in_edges = 1 + static_cast<int>(random() % 2); in_edges > 0; in_edges--)
+                    {
+                        node_t* tail = block_nodes[random() % i];
+                        glued.add_edge(tail->add_pin(pin_type_t::out), block_nodes[i]->add_pin(pin_type_t::in))->weight = 1 + static_cast<int>(random() % 3);
+                    }
+                }
+            }
+            rank_stats_t blocks_stats;
+            assert(glued.rank_blocks(&blocks_stats));
+            vector<int> serial_ranks;
+            for (auto n : glued.nodes)
+            {
+                serial_ranks.push_back(n->rank);
+            }
+            for (auto& [key, e] : glued.edges)
+            {
+                assert(e->length() >= e->min_length);
+            }
+            glued.thread_pool = &block_pool;
+            assert(glued.rank_blocks());
+            for (size_t i = 0; i < glued.nodes.size(); i++)
+            {
+                assert(glued.nodes[i]->rank == serial_ranks[i]);
+            }
+            assert(blocks_stats.weighted_length == glued.rank().weighted_length);
+        }
+
+        // A session that lays a component out again from scratch starts network simplex from its last ranks.
+        layout_session_t session;
+        for (size_t i = 0; i < 12; i++)
+        {
+            session.apply(layout_edit_t{layout_edit_kind_t::add_node, i});
+        }
+        for (size_t i = 1; i < 12; i++)
+        {
+            session.apply(layout_edit_t{layout_edit_kind_t::add_edge, i / 2, i});
+        }
+        session.arrange();
+        assert(session.full_count == 1 && session.seeded_count == 0);
+        session.max_changed_ratio = 0;
+        session.apply(layout_edit_t{layout_edit_kind_t::add_edge, 1, 11});
+        session.arrange();
+        assert(session.full_count == 1 && session.seeded_count == 1);
+        for (size_t i = 1; i < 12; i++)
+        {
+            assert(session.get_bound(i / 2).r < session.get_bound(i).l);
+        }
+        assert(session.get_bound(1).r < session.get_bound(11).l);
+
+        // A small edit is laid out from the last ranks and orders: nodes that didn't change keep their ranks, the
+        // first of them keeps its place and the new node goes right of its tail. Edits that don't fit are refused.
+        layout_session_t incremental;
+        for (size_t i = 0; i < 24; i++)
+        {
+            incremental.apply(layout_edit_t{layout_edit_kind_t::add_node, i});
+        }
+        for (size_t i = 1; i < 24; i++)
+        {
+            incremental.apply(layout_edit_t{layout_edit_kind_t::add_edge, (i - 1) / 3, i});
+        }
+        incremental.arrange();
+        vector<rect_t> before;
+        for (size_t i = 0; i < 24; i++)
+        {
+            before.push_back(incremental.get_bound(i));
+        }
+        assert(!incremental.apply(layout_edit_t{layout_edit_kind_t::add_edge, 5, 99}));
+        assert(!incremental.apply(layout_edit_t{layout_edit_kind_t::add_node, 5}));
+        assert(incremental.apply({layout_edit_t{layout_edit_kind_t::add_node, 24}, layout_edit_t{layout_edit_kind_t::add_edge, 20, 24}}));
+        incremental.arrange();
+        assert(incremental.incremental_count == 1 && incremental.full_count == 0);
+        assert(incremental.get_bound(0).l == before[0].l && incremental.get_bound(0).t == before[0].t);
+        for (size_t a = 0; a < 24; a++)
+        {
+            for (size_t b = 0; b < 24; b++)
+            {
+                if (a != 20 && b != 20 && before[a].l < before[b].l)
+                {
+                    assert(incremental.get_bound(a).l < incremental.get_bound(b).l);
+                }
+            }
+        }
+        assert(incremental.get_bound(20).r < incremental.get_bound(24).l);
+
+        // Found by laying out random cyclic graphs with acyclic_mode_t::greedy. Chains of block classes used to be
+        // shifted as if their neighbour class stayed, which put nodes 1 and 10 on top of each other.
+        const string cyclic = "digraph { 1 -> 6; 0 -> 11 [weight=3]; 11 -> 1; 1 -> 0 [weight=9]; 11 -> 1; 5 -> 4 [weight=7]; "
+            "11 -> 3 [weight=9]; 8 -> 5; 3 -> 2 [weight=5]; 7 -> 0; 0 -> 1 [weight=0]; 7 -> 1; 7 -> 9; 7 -> 1; 0 -> 1; "
+            "10 -> 0 [weight=7]; 5 -> 8; 3 -> 2 [weight=6]; 8 -> 9 [weight=7]; "
+            "2 [width=0.5, height=3.0]; 5 [width=2.3, height=2.3]; 8 [width=2.7, height=1.6] }";
+        for (auto mode : {acyclic_mode_t::depth_first, acyclic_mode_t::greedy})
+        {
+            auto imported = dynamic_cast<connected_graph_t*>(import_dot(cyclic.data(), cyclic.size()));
+            assert(imported);
+            imported->acyclic_mode = mode;
+            imported->arrange();
+            for (size_t i = 0; i < imported->nodes.size(); i++)
+            {
+                for (size_t j = i + 1; j < imported->nodes.size(); j++)
+                {
+                    const node_t* a = imported->nodes[i];
+                    const node_t* b = imported->nodes[j];
+                    const bool is_apart_x = a->position.x + a->size.x <= b->position.x || b->position.x + b->size.x <= a->position.x;
+                    const bool is_apart_y = a->position.y + a->size.y <= b->position.y || b->position.y + b->size.y <= a->position.y;
+                    assert(is_apart_x || is_apart_y);
+                }
+            }
+            delete imported;
+        }
+
+        // Stable ordering keeps the order the nodes were found in where the edges don't prefer one, the barycenter
+        // sweeps alone fall back to the order they were added in.
+        auto arrange_fan = [](bool is_stable_ordering)
+        {
+            auto fan = make_unique<connected_graph_t>();
+            fan->is_stable_ordering = is_stable_ordering;
+            auto root = fan->add_node("root");
+            auto out = root->add_pin(pin_type_t::out);
+            for (auto [name, y] : vector<pair<const char*, float>>{{"a", 100}, {"b", 200}, {"c", 0}})
+            {
+                auto leaf = fan->add_node(name);
+                leaf->position = vector2_t{200, y};
+                fan->add_edge(out, leaf->add_pin(pin_type_t::in));
+            }
+            fan->arrange();
+            return fan;
+        };
+        auto stable_fan = arrange_fan(true);
+        assert(stable_fan->nodes[3]->position.y < stable_fan->nodes[1]->position.y && stable_fan->nodes[1]->position.y < stable_fan->nodes[2]->position.y);
+        auto swept_fan = arrange_fan(false);
+        assert(swept_fan->nodes[1]->position.y < swept_fan->nodes[2]->position.y && swept_fan->nodes[2]->position.y < swept_fan->nodes[3]->position.y);
+
+        // Components come in the order of their first node, each keeps the order of nodes, and all of them move out
+        // with their edges.
+        graph_t scattered;
+        vector<node_t*> scattered_nodes;
+        for (int i = 0; i < 10; i++)
+        {
+            scattered_nodes.push_back(scattered.add_node());
+        }
+        for (auto [tail, head] : vector<pair<int, int>>{{0, 5}, {5, 2}, {7, 3}, {4, 9}, {9, 7}, {8, 6}, {6, 8}})
+        {
+            scattered.add_edge(scattered_nodes[tail]->add_pin(pin_type_t::out), scattered_nodes[head]->add_pin(pin_type_t::in));
+        }
+        const auto groups = scattered.to_connected_groups();
+        const vector<vector<int>> expected_groups{{0, 2, 5}, {1}, {3, 4, 7, 9}, {6, 8}};
+        assert(groups.size() == expected_groups.size());
+        for (size_t i = 0; i < groups.size(); i++)
+        {
+            assert(groups[i].size() == expected_groups[i].size());
+            for (size_t j = 0; j < groups[i].size(); j++)
+            {
+                assert(groups[i][j] == scattered_nodes[expected_groups[i][j]]);
+            }
+        }
+        unique_ptr<graph_t> split(scattered.to_connected_or_disconnected());
+        assert(scattered.nodes.empty() && scattered.edges.empty());
+        auto split_components = dynamic_cast<disconnected_graph_t*>(split.get());
+        assert(split_components && split_components->get_connected_graphs().size() == 4);
+        assert(split_components->get_connected_graphs()[2]->edges.size() == 3);
+        assert(split_components->get_connected_graphs()[3]->edges.size() == 2);
+
+        // Bounds of the named nodes of an arranged graph.
+        auto named_bounds = [](graph_t* graph)
+        {
+            map<string, vector<float>> bounds;
+            graph->visit_bounds([&bounds](node_t* n, const rect_t& rect)
+            {
+                if (!n->is_dummy_node)
+                {
+                    bounds[n->name] = {rect.l, rect.t, rect.r, rect.b};
+                }
+            });
+            return bounds;
+        };
+        // Bounds of the named nodes of a DOT graph arranged on a pool of thread_count threads, or without one.
+        auto arrange_on_threads = [&named_bounds](const string& dot, size_t thread_count)
+        {
+            unique_ptr<thread_pool_t> pool(thread_count > 0 ? new thread_pool_t(thread_count) : nullptr);
+            unique_ptr<graph_t> graph(import_dot(dot.data(), dot.size()));
+            assert(graph);
+            graph->thread_pool = pool.get();
+            graph->arrange();
+            return named_bounds(graph.get());
+        };
+
+        // Components arranged concurrently end up where arranging them one by one puts them.
+        ostringstream components;
+        components << "digraph {";
+        for (int component = 0; component < 6; component++)
+        {
+            const int node_count = 4 + component * 3;
+            for (int i = 1; i < node_count; i++)
+            {
+                components << " c" << component << "_" << random() % i << " -> c" << component << "_" << i << ";";
+            }
+        }
+        components << " }";
+        const auto component_bounds = arrange_on_threads(components.str(), 0);
+        assert(component_bounds.size() == 6 * 4 + 3 * 15);
+        assert(arrange_on_threads(components.str(), 1) == component_bounds);
+        assert(arrange_on_threads(components.str(), 4) == component_bounds);
+
+        // Sibling clusters, and the clusters nested in them, arranged concurrently bottom-up match the serial result.
+        ostringstream clusters;
+        clusters << "digraph {";
+        for (int outer = 0; outer < 4; outer++)
+        {
+            clusters << " subgraph cluster_" << outer << " {";
+            for (int inner = 0; inner < 3; inner++)
+            {
+                clusters << " subgraph cluster_" << outer << "_" << inner << " {";
+                for (int i = 1; i < 3 + inner; i++)
+                {
+                    clusters << " n" << outer << "_" << inner << "_" << random() % i << " -> n" << outer << "_" << inner << "_" << i << ";";
+                }
+                clusters << " }";
+            }
+            clusters << " n" << outer << "_0_0 -> n" << outer << "_1_0; n" << outer << "_0_1 -> n" << outer << "_2_0; }";
+        }
+        clusters << " n0_0_0 -> n1_0_0; n1_1_0 -> n2_0_0; n1_2_1 -> n3_0_0; }";
+        const auto cluster_bounds = arrange_on_threads(clusters.str(), 0);
+        assert(cluster_bounds.size() == 4 * (3 + 4 + 5) + 4 * 4);
+        assert(arrange_on_threads(clusters.str(), 1) == cluster_bounds);
+        assert(arrange_on_threads(clusters.str(), 4) == cluster_bounds);
+
+        // Moves of an arranged graph only add up pending offsets, the nested nodes come out moved by their sum.
+        unique_ptr<graph_t> moved_clusters(import_dot(clusters.str().data(), clusters.str().size()));
+        moved_clusters->arrange();
+        const vector2_t origin{moved_clusters->bound.l, moved_clusters->bound.t};
+        moved_clusters->set_position(origin + vector2_t{300, -200});
+        moved_clusters->set_position(origin + vector2_t{1000, 500});
+        assert(moved_clusters->pending_offset.x == 1000 && moved_clusters->pending_offset.y == 500);
+        size_t moved_count = 0;
+        moved_clusters->visit_bounds([&cluster_bounds, &moved_count](node_t* n, const rect_t& rect)
+        {
+            if (!n->is_dummy_node)
+            {
+                const auto& bound = cluster_bounds.at(n->name);
+                assert(std::abs(rect.l - bound[0] - 1000) < 0.01f && std::abs(rect.t - bound[1] - 500) < 0.01f);
+                assert(std::abs(rect.r - bound[2] - 1000) < 0.01f && std::abs(rect.b - bound[3] - 500) < 0.01f);
+                moved_count++;
+            }
+        });
+        assert(moved_count == cluster_bounds.size());
+
+        // One walk of the visitors reaches the user pointers of nested nodes, and pin offsets of every component
+        // are relative to the corner of the whole graph.
+        moved_clusters->visit_bounds([](node_t* n, const rect_t&) { n->user_ptr = n; });
+        assert(moved_clusters->get_user_pointers().size() == cluster_bounds.size());
+        unique_ptr<graph_t> offset_components(import_dot(components.str().data(), components.str().size()));
+        offset_components->arrange();
+        const auto node_bounds = offset_components->get_bounds();
+        const rect_t whole = offset_components->bound;
+        size_t pin_count = 0;
+        offset_components->visit_pins_offset([&node_bounds, &whole, &pin_count](pin_t* pin, vector2_t offset)
+        {
+            const rect_t& owner = node_bounds.at(pin->owner);
+            assert(std::abs(offset.x - (owner.l - whole.l + pin->offset.x)) < 0.01f);
+            assert(std::abs(offset.y - (owner.t - whole.t + pin->offset.y)) < 0.01f);
+            pin_count++;
+        });
+        assert(pin_count > 0 && pin_count == offset_components->get_pins().size());
+
+        // The same structure hashes the same wherever it was put, weights are part of the structure.
+        unique_ptr<graph_t> rebuilt_components(import_dot(components.str().data(), components.str().size()));
+        assert(structural_hash(rebuilt_components.get()) == structural_hash(offset_components.get()));
+        auto rebuilt_first = dynamic_cast<disconnected_graph_t*>(rebuilt_components.get())->get_connected_graphs()[0];
+        rebuilt_first->nodes[0]->position = vector2_t{500, 500};
+        assert(structural_hash(rebuilt_components.get()) == structural_hash(offset_components.get()));
+        rebuilt_first->edges.begin()->second->weight = 2;
+        assert(structural_hash(rebuilt_components.get()) != structural_hash(offset_components.get()));
+
+        // A graph arranged again with a cache takes the cached layout of its root, and relative to the anchor every
+        // node ends where arranging without one puts it, nested clusters included. Where the anchor ends differs, a
+        // cached layout leaves it where it was.
+        layout_cache_t cache;
+        auto arrange_cached = [&clusters, &named_bounds](layout_cache_t* cache)
+        {
+            unique_ptr<graph_t> graph(import_dot(clusters.str().data(), clusters.str().size()));
+            graph->layout_cache = cache;
+            graph->arrange();
+            auto bounds = named_bounds(graph.get());
+            const vector2_t anchor = graph->layout_anchor->position;
+            for (auto& [name, bound] : bounds)
+            {
+                bound = {bound[0] - anchor.x, bound[1] - anchor.y, bound[2] - anchor.x, bound[3] - anchor.y};
+            }
+            return bounds;
+        };
+        const auto uncached_bounds = arrange_cached(nullptr);
+        assert(arrange_cached(&cache) == uncached_bounds);
+        const size_t cold_hits = cache.hits();
+        const size_t cold_misses = cache.misses();
+        assert(cold_misses > 0 && cache.size() == cold_misses);
+        assert(arrange_cached(&cache) == uncached_bounds);
+        assert(cache.hits() == cold_hits + 1 && cache.misses() == cold_misses);
+
+        // Identical components are arranged once, the copies take the layout relative to their own anchor.
+        const string copies = "digraph { a0 -> b0; a0 -> c0; b0 -> d0; c0 -> d0; a1 -> b1; a1 -> c1; b1 -> d1; c1 -> d1; "
+            "x -> y; a2 -> b2; a2 -> c2; b2 -> d2; c2 -> d2; }";
+        unique_ptr<graph_t> copied(import_dot(copies.data(), copies.size()));
+        copied->arrange();
+        const auto& copied_graphs = dynamic_cast<disconnected_graph_t*>(copied.get())->get_connected_graphs();
+        assert(copied_graphs.size() == 4);
+        assert(!static_cast<connected_graph_t*>(copied_graphs[0])->layers.empty());
+        assert(static_cast<connected_graph_t*>(copied_graphs[1])->layers.empty() && static_cast<connected_graph_t*>(copied_graphs[3])->layers.empty());
+        const auto copied_bounds = named_bounds(copied.get());
+        for (auto copy : {"1", "2"})
+        {
+            for (auto name : {"b", "c", "d"})
+            {
+                const auto& original = copied_bounds.at(string(name) + "0");
+                const auto& original_anchor = copied_bounds.at("a0");
+                const auto& bound = copied_bounds.at(name + string(copy));
+                const auto& anchor = copied_bounds.at("a" + string(copy));
+                for (size_t i = 0; i < 4; i++)
+                {
+                    assert(bound[i] - anchor[i] == original[i] - original_anchor[i]);
+                }
+            }
+        }
+
+        // The least recently used layout is the one dropped.
+        layout_cache_t small_cache(2);
+        small_cache.insert(1, make_shared<cached_layout_t>());
+        small_cache.insert(2, make_shared<cached_layout_t>());
+        assert(small_cache.find(1));
+        small_cache.insert(3, make_shared<cached_layout_t>());
+        assert(small_cache.size() == 2 && small_cache.find(1) && small_cache.find(3) && !small_cache.find(2));
+
+        test_graph_file();
+        test_graph_import();
+        test_layout_store();
     }
 }
\ No newline at end of file
@@ -9,6 +9,8 @@
 #include <vector>
 #include <map>
 #include <set>
+#include <unordered_map>
+#include <unordered_set>
 #include <string>
 #include <functional>
 #include <iostream>
@@ -18,7 +20,25 @@ namespace graph_layout
     struct graph_t;
     struct connected_graph_t;
     struct node_t;
+    struct pin_t;
+    struct edge_t;
     struct vector2_t;
+    class thread_pool_t;
+    class layout_cache_t;
+    class layout_session_t;
+
+    // Orders nodes, pins and edges by creation instead of by address. Containers keyed by them then iterate
+    // the same way on every run, so the layout doesn't depend on where the allocator put things.
+    struct creation_order_t
+    {
+        bool operator()(const node_t* a, const node_t* b) const;
+        bool operator()(const pin_t* a, const pin_t* b) const;
+        bool operator()(const edge_t* a, const edge_t* b) const;
+        bool operator()(const std::pair<pin_t*, pin_t*>& a, const std::pair<pin_t*, pin_t*>& b) const;
+    };
+
+    using node_set_t = std::set<node_t*, creation_order_t>;
+    using edge_set_t = std::set<edge_t*, creation_order_t>;
 
     enum class pin_type_t
     {
@@ -84,6 +104,8 @@ namespace graph_layout
         int index_in_layer = -1;
         pin_t* copy_from = nullptr;
         void* user_pointer = nullptr;
+        // Creation order within the owner.
+        size_t id = 0;
     };
 
     struct edge_t
@@ -94,6 +116,8 @@ namespace graph_layout
         int min_length = 1;
         int cut_value = 0;
         bool is_inverted = false;
+        // Creation order within the graph.
+        size_t id = 0;
         int length() const;
         int slack() const;
         bool is_crossing(const edge_t* other) const;
@@ -103,6 +127,8 @@ namespace graph_layout
     struct node_t
     {
         std::string name;
+        // Creation order within the graph.
+        size_t id = 0;
         bool is_dummy_node = false;
         graph_t* graph = nullptr;
         void* user_ptr = nullptr;
@@ -124,9 +150,9 @@ namespace graph_layout
         std::vector<edge_t*> get_edges_linked_to_layer(const std::vector<node_t*>& layer, bool is_in) const;
         bool is_crossing_inner_segment(const std::vector<node_t*>& lower_layer, const std::vector<node_t*>& upper_layer) const;
         float get_barycenter_in_layer(const std::vector<node_t*>& layer, bool is_in) const;
-        std::set<node_t*> get_direct_connected_nodes(const std::function<bool(edge_t*)>& filter) const;
-        std::set<node_t*> get_out_nodes() const;
-        std::set<node_t*> get_in_nodes() const;
+        node_set_t get_direct_connected_nodes(const std::function<bool(edge_t*)>& filter) const;
+        node_set_t get_out_nodes() const;
+        node_set_t get_in_nodes() const;
         node_t* get_median_upper() const;
         std::vector<node_t*> get_uppers() const;
         std::vector<node_t*> get_lowers() const;
@@ -135,24 +161,28 @@ namespace graph_layout
         float get_linked_position_to_node(const node_t* node, bool is_in, bool is_horizontal_dir = true) const;
         void update_pins_offset();
         void set_sub_graph(connected_graph_t* g);
-
-        node_t* clone() const;
         ~node_t();
     };
 
     struct tree_t
     {
-        std::set<edge_t*> tree_edges;
-        std::set<edge_t*> non_tree_edges;
-        std::set<node_t*> nodes;
-        edge_t* find_min_incident_edge(node_t** incident_node);
+        edge_set_t tree_edges;
+        edge_set_t non_tree_edges;
+        node_set_t nodes;
+        // Candidates may include tree edges, they never have exactly one end in the tree.
+        edge_t* find_min_incident_edge(const edge_set_t& candidates, node_t** incident_node) const;
         void tighten() const;
+        // Nodes and tree edges of the tight tree edges reachable from the first node, non tree edges are left empty.
         tree_t tight_sub_tree() const;
         edge_t* leave_edge() const;
         edge_t* enter_edge(edge_t* edge);
         void exchange(edge_t* e, edge_t* f);
         void calculate_cut_values();
-        void update_non_tree_edges(const std::set<edge_t*>& all_edges);
+        // Cut value of edge from splitting the tree at it and summing every other edge, quadratic in total. Checks
+        // calculate_cut_values().
+        int cut_value_by_split(edge_t* edge);
+        // Fills the non tree edges from the edges of the graph instead of from a copy of them.
+        void update_non_tree_edges(const std::map<std::pair<pin_t*, pin_t*>, edge_t*, creation_order_t>& edges);
 
     private:
         void reset_head_or_tail() const;
@@ -161,44 +191,139 @@ namespace graph_layout
         static void add_to_weights(const edge_t* edge, int& head_to_tail_weight, int& tail_to_head_weight);
     };
 
+    // Edges hidden from a graph without touching it. Algorithms that need the graph with some edges removed
+    // for a while read it through the mask instead of working on a copy.
+    struct edge_mask_t
+    {
+        std::unordered_set<const edge_t*> masked_edges;
+
+        void mask(const edge_t* edge) { masked_edges.insert(edge); }
+        bool is_masked(const edge_t* edge) const { return masked_edges.find(edge) != masked_edges.end(); }
+        // Can node be reached from ancestor over out edges that aren't masked?
+        bool is_descendant_of(const node_t* node, const node_t* ancestor) const;
+    };
+
+    // Where network simplex starts instead of init_rank() and a fresh feasible tree, e.g. the ranks of the last run
+    // kept by a layout session. Nodes and edges are those of the graph being ranked.
+    struct rank_seed_t
+    {
+        // Nodes without a rank go right below their tails. Edges shorter than their minimum length are repaired.
+        std::unordered_map<const node_t*, int> ranks;
+        // Used as the spanning tree when they still span the graph and are tight after the repair.
+        std::vector<const edge_t*> tree_edges;
+    };
+
+    struct rank_stats_t
+    {
+        size_t pivots = 0;
+        // Edges the seed left shorter than their minimum length.
+        size_t repaired_edges = 0;
+        bool is_seed_tree_used = false;
+        // Pivots were left when max_rank_pivots or rank_time_budget_ms stopped network simplex.
+        bool is_stopped_early = false;
+        // Sum of the edge lengths once ranked, and of the lengths times the weights, which network simplex minimizes.
+        size_t total_length = 0;
+        size_t weighted_length = 0;
+        float elapsed_ms = 0;
+    };
+
+    struct multilevel_stats_t
+    {
+        // Graphs from the original one to the coarsest, 1 when nothing was coarsened.
+        size_t levels = 0;
+        size_t coarsest_nodes = 0;
+    };
+
+    // Crossings of an order, counted or estimated from sampled pairs of edges with the variance of the estimate.
+    struct crossing_estimate_t
+    {
+        double value = 0;
+        double variance = 0;
+        // Lower than other by more than two standard errors of the difference, about 95% sure to cross less.
+        bool is_fewer_than(const crossing_estimate_t& other) const;
+    };
+
+    struct acyclic_stats_t
+    {
+        size_t inverted_edges = 0;
+        // Sum of the weights of the inverted edges.
+        size_t inverted_weight = 0;
+    };
+
+    enum class acyclic_mode_t
+    {
+        // Inverts the edges that close a cycle in a depth first search.
+        depth_first,
+        // Orders the nodes by a weighted Eades-Lin-Smyth greedy pass and inverts the edges pointing back, in linear time.
+        greedy,
+    };
+
     enum class rank_slot_t { none, min, max, };
 
     struct graph_t
     {
+        graph_t() = default;
+        // Takes over nodes, edges and sub graphs, other is left empty.
+        graph_t(graph_t&& other) noexcept;
+        graph_t& operator=(graph_t&& other) noexcept;
+        graph_t(const graph_t&) = delete;
+        graph_t& operator=(const graph_t&) = delete;
         virtual void translate(vector2_t offset);
         virtual ~graph_t();
         void set_position(vector2_t position);
-        virtual std::vector<pin_t*> get_pins() const { return {}; }
-        virtual std::map<pin_t*, vector2_t> get_pins_offset() { return {}; }
-        virtual std::set<void*> get_user_pointers() { return {}; }
-        virtual std::map<node_t*, rect_t> get_bounds() { return {}; }
+        // Applies the pending offset to the nodes and hands it down to their sub graphs, one level at a time.
+        void resolve_offset();
+        // Visitors walk the hierarchy once and hand every result to the callback, nothing is collected per level.
+        virtual void visit_pins(const std::function<void(pin_t*)>&) const {}
+        // Offsets are relative to the top left corner of the bound, the origin passed second is added to them.
+        virtual void visit_pins_offset(const std::function<void(pin_t*, vector2_t)>&, vector2_t = {0, 0}) {}
+        virtual void visit_user_pointers(const std::function<void(void*)>&) const {}
+        virtual void visit_bounds(const std::function<void(node_t*, const rect_t&)>&) {}
+        std::vector<pin_t*> get_pins() const;
+        std::map<pin_t*, vector2_t> get_pins_offset();
+        std::set<void*> get_user_pointers() const;
+        std::map<node_t*, rect_t> get_bounds();
 
         virtual void arrange()
         {
         }
 
-        virtual graph_t* clone() const;
-
         node_t* add_node(graph_t* sub_graph = nullptr);
         node_t* add_node(const std::string& name, graph_t* sub_graph = nullptr);
         void remove_node(node_t* node);
         edge_t* add_edge(pin_t* tail, pin_t* head);
         void remove_edge(const edge_t* edge);
         void remove_edge(pin_t* tail, pin_t* head);
-        void invert_edge(edge_t* edge) const;
+        void invert_edge(edge_t* edge);
 
-        std::vector<std::set<node_t*>> to_connected_groups() const;
-        graph_t* to_connected_or_disconnected() const;
-        static graph_t* to_connected(const std::set<node_t*>& nodes);
+        // Connected components by union-find over the edges, in the order of their first node in nodes.
+        std::vector<std::vector<node_t*>> to_connected_groups() const;
+        // Moves nodes, pins and edges into one connected graph per component, this graph is left empty.
+        graph_t* to_connected_or_disconnected();
+        // Moves the nodes, their edges and sub graphs into a new graph, edges must not leave the group.
+        connected_graph_t* to_connected(const std::vector<node_t*>& group);
 
         rect_t bound{0, 0, 0, 0};
         rect_t border{0, 0, 0, 0};
+        // Translation not applied to the nodes yet. Moving a node only adds to the offset of its sub graph, so
+        // nested graphs aren't walked again on every move, bound is always up to date with it.
+        vector2_t pending_offset{0, 0};
         std::vector<node_t*> nodes;
-        std::map<std::pair<pin_t*, pin_t*>, edge_t*> edges;
-        std::map<node_t*, graph_t*> sub_graphs;
+        std::map<std::pair<pin_t*, pin_t*>, edge_t*, creation_order_t> edges;
+        std::map<node_t*, graph_t*, creation_order_t> sub_graphs;
         std::map<void*, pin_t*> user_ptr_to_pin;
         vector2_t spacing = {80, 80};
         bool is_vertical_layout = false;
+        // Independent parts of the layout run on it when set, child graphs without one inherit it.
+        thread_pool_t* thread_pool = nullptr;
+        // Layouts are looked up by structure before arranging when set, child graphs without one inherit it.
+        layout_cache_t* layout_cache = nullptr;
+        // Ranks and orders of the last layout are reused for small edits when set, child graphs without one inherit it.
+        layout_session_t* layout_session = nullptr;
+        // Real node that kept its position in the last arrange(), results are relative to it.
+        node_t* layout_anchor = nullptr;
+        // Source of node and edge ids.
+        size_t next_id = 0;
     };
 
     struct disconnected_graph_t : public graph_t
@@ -206,11 +331,12 @@ namespace graph_layout
         void add_graph(graph_t* graph);
         ~disconnected_graph_t() override;
         void translate(vector2_t offset) override;
-        std::vector<pin_t*> get_pins() const override;
-        std::map<pin_t*, vector2_t> get_pins_offset() override;
-        std::map<node_t*, rect_t> get_bounds() override;
+        void visit_pins(const std::function<void(pin_t*)>& visitor) const override;
+        void visit_pins_offset(const std::function<void(pin_t*, vector2_t)>& visitor, vector2_t origin = {0, 0}) override;
+        void visit_bounds(const std::function<void(node_t*, const rect_t&)>& visitor) override;
         void arrange() override;
-        std::set<void*> get_user_pointers() override;
+        void visit_user_pointers(const std::function<void(void*)>& visitor) const override;
+        const std::vector<graph_t*>& get_connected_graphs() const { return connected_graphs; }
 
     private:
         std::vector<graph_t*> connected_graphs;
@@ -219,13 +345,55 @@ namespace graph_layout
     struct connected_graph_t : public graph_t
     {
         size_t max_iterations = 24;
+        // Layers start in the order of the current positions and sweeps pull nodes back toward it, so arranging
+        // an arranged graph again keeps the order the user had. Runs at most stable_iterations sweeps.
+        bool is_stable_ordering = false;
+        size_t stable_iterations = 4;
+        // Weight of the starting order against the barycenter of the neighbors, from 0 to 1.
+        float movement_penalty = 0.5f;
+        // After the barycenter sweeps, every node is moved through all places in its layer and left where its edges
+        // cross the fewest others, for at most sifting_iterations sweeps. Not run with stable ordering.
+        bool is_sifting_enabled = false;
+        size_t sifting_iterations = 2;
+        // Nodes with more edges than this are left out of the ordering sweeps, with their edges, and put where
+        // their edges cross the fewest others afterwards. 0 turns it off, so does stable ordering.
+        size_t hub_degree = 0;
+        // When sweeps are compared, two layers with more pairs of edges between them than this have the crossings
+        // estimated from this many pairs drawn with a fixed seed, and a sweep has to win by the confidence bound.
+        // The order kept is counted exactly before sifting. 0 counts every pair.
+        size_t crossing_sample_size = 0;
+        // Trees are laid out by a tidy tree pass in linear time instead of the layered pipeline. Layers and gaps
+        // are the same, the placement across the layers differs, so it is off unless asked for.
+        bool is_tree_layout_enabled = false;
+        // Chains of nodes with one edge in and one out are ranked as one edge between their ends.
+        bool is_chain_compression_enabled = true;
+        // Biconnected blocks are ranked on their own, on thread_pool when set. Blocks only share articulation nodes
+        // and moving a block as a whole costs nothing, so the ranking is as good as the one of the whole graph.
+        bool is_block_decomposition_enabled = true;
+        // Long edges leaving one pin share a chain of dummy nodes, each leaves it at the rank above its head. Fewer
+        // dummies to order and place, and the edges run together until they part.
+        bool is_edge_bundling_enabled = false;
+        // Graphs with more nodes than this are coarsened to about coarse_target nodes and laid out there, ranks and
+        // orders are projected back a level at a time with refinement_iterations sweeps on each. 0 turns it off.
+        size_t multilevel_threshold = 0;
+        size_t coarse_target = 200;
+        size_t refinement_iterations = 4;
+        acyclic_mode_t acyclic_mode = acyclic_mode_t::depth_first;
+        // Network simplex starts from the longest path ranks and stops after max_rank_pivots pivots or when ranking
+        // took rank_time_budget_ms, which blocks share. Every pivot keeps the ranks feasible, stopping early only
+        // leaves edges longer. No pivots skip the spanning tree and rank by longest path alone, in linear time.
+        // The budget is checked while the feasible tree grows and between pivots, so it is overrun by at most one
+        // round of tree growth or one pivot, each linear in the edges.
+        bool is_bounded_ranking = false;
+        size_t max_rank_pivots = 100;
+        float rank_time_budget_ms = 50;
         node_t* min_ranking_node = nullptr;
         node_t* max_ranking_node = nullptr;
         std::vector<std::vector<node_t*>> layers;
-
-        graph_t* clone() const override;
-        connected_graph_t* clone(std::map<node_t*, node_t*>& nodes_map, std::map<pin_t*, pin_t*>& pins_map, std::map<edge_t*, edge_t*>& edges_map,
-                                 std::map<node_t*, node_t*>& nodes_map_inv, std::map<pin_t*, pin_t*>& pins_map_inv, std::map<edge_t*, edge_t*>& edges_map_inv) const;
+        // What the last acyclic() in arrange() inverted, nothing when the layout came from the cache or the session.
+        acyclic_stats_t acyclic_stats;
+        // Ranking of the last arrange() through the layered pipeline, nothing for trees, multilevel and reused layouts.
+        rank_stats_t rank_stats;
 
         void set_node_in_rank_slot(node_t* node, rank_slot_t rank_slot);
 
@@ -234,34 +402,97 @@ namespace graph_layout
         std::vector<node_t*> get_source_nodes() const;
         std::vector<node_t*> get_sink_nodes() const;
 
-        void acyclic() const;
-        void rank() const;
+        acyclic_stats_t acyclic();
+        // Network simplex, from scratch or from seed. The ranks and spanning tree it ends with go to result when set.
+        rank_stats_t rank(const rank_seed_t* seed = nullptr, rank_seed_t* result = nullptr) const;
+        // Same ranks as rank() from scratch, with network simplex run on the graph with every chain contracted into
+        // an edge. The span of each chain goes to its edges of lowest weight. False, and nothing ranked, without chains.
+        bool rank_compressed_chains(rank_stats_t* stats = nullptr) const;
+        // Ranks every block on its own, then shifts the blocks to agree on their articulation nodes. Edges must be
+        // acyclic. False, and nothing ranked, for a single block or a graph with self loops. The stats of the blocks
+        // add up in stats when set.
+        bool rank_blocks(rank_stats_t* stats = nullptr);
         void add_dummy_nodes(tree_t* feasible_tree);
         void assign_layers();
         void ordering();
+        // Edges of every biconnected block, directions ignored, by an iterative Hopcroft-Tarjan search. Nodes in
+        // more than one block are articulation nodes. Self loops are in none.
+        std::vector<std::vector<edge_t*>> get_blocks() const;
+        // Acyclic, rank, dummy nodes, layers and ordering through coarser copies of the graph.
+        multilevel_stats_t arrange_multilevel();
 
         void translate(vector2_t offset) override;
         void arrange() override;
-        std::vector<pin_t*> get_pins() const override;
-        std::map<pin_t*, vector2_t> get_pins_offset() override;
-        std::map<node_t*, rect_t> get_bounds() override;
-        std::set<void*> get_user_pointers() override;
+        void visit_pins(const std::function<void(pin_t*)>& visitor) const override;
+        void visit_pins_offset(const std::function<void(pin_t*, vector2_t)>& visitor, vector2_t origin = {0, 0}) override;
+        void visit_bounds(const std::function<void(node_t*, const rect_t&)>& visitor) override;
+        void visit_user_pointers(const std::function<void(void*)>& visitor) const override;
 
         void assign_coordinate();
         std::vector<rect_t> get_layers_bound() const;
-        void sort_layers(std::vector<std::vector<node_t*>>& layer_vec, bool is_down) const;
-        tree_t feasible_tree() const;
+        // Sorts by the barycenter of the neighbors, blended with the starting order when anchors are given.
+        void sort_layers(std::vector<std::vector<node_t*>>& layer_vec, bool is_down, const std::unordered_map<const node_t*, float>* anchors = nullptr) const;
+        // Stops growing with fewer nodes than the graph when is_out_of_time says so, the ranks are feasible either way.
+        tree_t feasible_tree(const std::function<bool()>& is_out_of_time = nullptr) const;
         std::string generate_test_code();
 
         static void calculate_pins_index_in_layer(const std::vector<node_t*>& layer);
         static std::vector<edge_t*> get_edges_between_two_layers(const std::vector<node_t*>& lower, const std::vector<node_t*>& upper, const node_t* excluded_node = nullptr);
         static size_t crossing(const std::vector<std::vector<node_t*>>& order, bool calculate_pins_index);
+        // Exact for sample_size 0, the same order always gets the same estimate.
+        static crossing_estimate_t estimate_crossing(const std::vector<std::vector<node_t*>>& order, size_t sample_size);
         static void test();
 
     private:
         void init_rank() const;
+        // Edges closing a cycle in a depth first search from the sources, or the sinks when there are none.
+        std::vector<edge_t*> depth_first_feedback_edges() const;
+        // Ranks, layers and positions of a tree whose edges all point away from or toward one root, false for
+        // other graphs. Minimum lengths other than one also go through the layered pipeline.
+        bool arrange_tree();
+        // Graph with every node matched to the neighbor of its heaviest edge, parents maps nodes to their merged node.
+        connected_graph_t* coarsen(std::unordered_map<const node_t*, node_t*>& parents) const;
+        // Pushes nodes down until every edge is long enough, then moves them one at a time toward the side with the
+        // heavier edges for at most sweeps passes, which never makes the ranking worse. Edges must be acyclic.
+        void refine_ranks(size_t sweeps) const;
+        // Orders the layers by position and returns the index of every real node in its layer.
+        std::unordered_map<const node_t*, float> order_layers_by_position();
+        // Barycenter sweeps, stable or followed by sifting when enabled, keeping the order with the fewest crossings.
+        void sweep_layers();
+        // Sifting sweeps over the layers, returns the crossings removed. Pin indices must be up to date.
+        size_t sift_layers(std::vector<std::vector<node_t*>>& layer_vec) const;
         void normalize() const;
         tree_t tight_tree() const;
-        std::vector<node_t*> get_nodes_without_unscanned_in_edges(const std::set<node_t*>& visited, const std::set<edge_t*>& scanned_set) const;
+        // Tight tree from the current ranks, moving the tree until it reaches every node.
+        tree_t grow_feasible_tree(const std::function<bool()>& is_out_of_time = nullptr) const;
+        tree_t seeded_feasible_tree(const rank_seed_t& seed, rank_stats_t& stats, const std::function<bool()>& is_out_of_time = nullptr) const;
     };
+
+    inline bool creation_order_t::operator()(const node_t* a, const node_t* b) const
+    {
+        return a->id != b->id ? a->id < b->id : a < b;
+    }
+
+    inline bool creation_order_t::operator()(const pin_t* a, const pin_t* b) const
+    {
+        if (a->owner != b->owner)
+        {
+            return (*this)(a->owner, b->owner);
+        }
+        return a->id != b->id ? a->id < b->id : a < b;
+    }
+
+    inline bool creation_order_t::operator()(const edge_t* a, const edge_t* b) const
+    {
+        return a->id != b->id ? a->id < b->id : a < b;
+    }
+
+    inline bool creation_order_t::operator()(const std::pair<pin_t*, pin_t*>& a, const std::pair<pin_t*, pin_t*>& b) const
+    {
+        if (a.first != b.first)
+        {
+            return (*this)(a.first, b.first);
+        }
+        return a.second != b.second && (*this)(a.second, b.second);
+    }
 }
@@ -0,0 +1,414 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Howaajin. All rights reserved.
+ *  Licensed under the MIT License. See License in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+
+#include "layout_cache.h"
+#include "layout_store.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace graph_layout
+{
+    using namespace std;
+
+    namespace
+    {
+        // 64 bit FNV-1a over the bytes of every value added.
+        struct hasher_t
+        {
+            uint64_t value = 14695981039346656037ull;
+
+            void add_bytes(const void* data, size_t size)
+            {
+                auto bytes = static_cast<const uint8_t*>(data);
+                for (size_t i = 0; i < size; i++)
+                {
+                    value = (value ^ bytes[i]) * 1099511628211ull;
+                }
+            }
+
+            void add(uint64_t v)
+            {
+                add_bytes(&v, sizeof(v));
+            }
+
+            void add(float v)
+            {
+                // 0 and -0 lay out the same.
+                if (v == 0.0f)
+                {
+                    v = 0.0f;
+                }
+                uint32_t bits;
+                memcpy(&bits, &v, sizeof(bits));
+                add_bytes(&bits, sizeof(bits));
+            }
+
+            void add(vector2_t v)
+            {
+                add(v.x);
+                add(v.y);
+            }
+
+            void add(const rect_t& rect)
+            {
+                add(rect.l);
+                add(rect.t);
+                add(rect.r);
+                add(rect.b);
+            }
+        };
+
+        void hash_graph(const graph_t* graph, hasher_t& hasher)
+        {
+            hasher.add(graph->spacing);
+            hasher.add(static_cast<uint64_t>(graph->is_vertical_layout));
+            hasher.add(graph->border);
+            if (auto disconnected = dynamic_cast<const disconnected_graph_t*>(graph))
+            {
+                hasher.add(uint64_t{1});
+                hasher.add(static_cast<uint64_t>(disconnected->get_connected_graphs().size()));
+                for (auto component : disconnected->get_connected_graphs())
+                {
+                    hash_graph(component, hasher);
+                }
+                return;
+            }
+            auto connected = dynamic_cast<const connected_graph_t*>(graph);
+            hasher.add(uint64_t{0});
+            hasher.add(static_cast<uint64_t>(connected ? connected->max_iterations : 0));
+            hasher.add(static_cast<uint64_t>(connected && connected->is_tree_layout_enabled));
+            hasher.add(static_cast<uint64_t>(connected && connected->is_chain_compression_enabled));
+            hasher.add(static_cast<uint64_t>(connected && connected->is_block_decomposition_enabled));
+            hasher.add(static_cast<uint64_t>(connected && connected->is_edge_bundling_enabled));
+            hasher.add(static_cast<uint64_t>(connected ? connected->acyclic_mode : acyclic_mode_t::depth_first));
+            hasher.add(static_cast<uint64_t>(connected ? connected->hub_degree : 0));
+            hasher.add(static_cast<uint64_t>(connected ? connected->crossing_sample_size : 0));
+            const bool is_sifting = connected && connected->is_sifting_enabled;
+            hasher.add(static_cast<uint64_t>(is_sifting));
+            if (is_sifting)
+            {
+                hasher.add(static_cast<uint64_t>(connected->sifting_iterations));
+            }
+            const bool is_bounded = connected && connected->is_bounded_ranking;
+            hasher.add(static_cast<uint64_t>(is_bounded));
+            if (is_bounded)
+            {
+                hasher.add(static_cast<uint64_t>(connected->max_rank_pivots));
+                hasher.add(vector2_t{connected->rank_time_budget_ms, 0});
+            }
+            const bool is_multilevel = connected && connected->multilevel_threshold > 0 && graph->nodes.size() > connected->multilevel_threshold;
+            hasher.add(static_cast<uint64_t>(is_multilevel));
+            if (is_multilevel)
+            {
+                hasher.add(static_cast<uint64_t>(connected->coarse_target));
+                hasher.add(static_cast<uint64_t>(connected->refinement_iterations));
+            }
+            // Stable ordering starts from the positions, relative to the first node since moving all of them changes nothing.
+            const bool is_stable = connected && connected->is_stable_ordering;
+            hasher.add(static_cast<uint64_t>(is_stable));
+            if (is_stable)
+            {
+                hasher.add(static_cast<uint64_t>(connected->stable_iterations));
+                hasher.add(vector2_t{connected->movement_penalty, 0});
+                for (auto n : graph->nodes)
+                {
+                    hasher.add(n->position - graph->nodes[0]->position);
+                }
+            }
+            hasher.add(static_cast<uint64_t>(graph->nodes.size()));
+            unordered_map<const node_t*, uint64_t> indices;
+            indices.reserve(graph->nodes.size());
+            for (auto n : graph->nodes)
+            {
+                const uint64_t index = indices.size();
+                indices[n] = index;
+            }
+            const uint64_t none = ~uint64_t{0};
+            auto index_of = [&indices, none](const node_t* n)
+            {
+                auto it = indices.find(n);
+                return it == indices.end() ? none : it->second;
+            };
+            hasher.add(connected ? index_of(connected->min_ranking_node) : none);
+            hasher.add(connected ? index_of(connected->max_ranking_node) : none);
+            for (auto n : graph->nodes)
+            {
+                hasher.add(static_cast<uint64_t>(n->is_dummy_node));
+                hasher.add(n->size);
+                hasher.add(static_cast<uint64_t>(n->in_pins.size()));
+                hasher.add(static_cast<uint64_t>(n->out_pins.size()));
+                for (auto pins : {&n->in_pins, &n->out_pins})
+                {
+                    for (auto p : *pins)
+                    {
+                        hasher.add(static_cast<uint64_t>(p->type));
+                        hasher.add(static_cast<uint64_t>(p->id));
+                        hasher.add(p->offset);
+                    }
+                }
+                hasher.add(static_cast<uint64_t>(n->graph != nullptr));
+                if (n->graph)
+                {
+                    hash_graph(n->graph, hasher);
+                }
+            }
+            hasher.add(static_cast<uint64_t>(graph->edges.size()));
+            for (auto& [key, e] : graph->edges)
+            {
+                hasher.add(index_of(e->tail->owner));
+                hasher.add(static_cast<uint64_t>(e->tail->id));
+                hasher.add(index_of(e->head->owner));
+                hasher.add(static_cast<uint64_t>(e->head->id));
+                hasher.add(static_cast<uint64_t>(e->weight));
+                hasher.add(static_cast<uint64_t>(e->min_length));
+            }
+        }
+
+        void capture_graph(graph_t* graph, vector2_t origin, const node_t* anchor, cached_layout_t& layout)
+        {
+            graph->resolve_offset();
+            layout.bounds.push_back(graph->bound.offset_by(vector2_t{0, 0} - origin));
+            if (auto disconnected = dynamic_cast<disconnected_graph_t*>(graph))
+            {
+                for (auto component : disconnected->get_connected_graphs())
+                {
+                    capture_graph(component, origin, anchor, layout);
+                }
+                return;
+            }
+            for (auto n : graph->nodes)
+            {
+                if (n->is_dummy_node)
+                {
+                    continue;
+                }
+                cached_layout_t::node_result_t result;
+                result.position = n->position - origin;
+                result.size = n->size;
+                result.rank = n->rank;
+                result.first_pin = static_cast<uint32_t>(layout.pin_offsets.size());
+                result.pin_count = static_cast<uint32_t>(n->in_pins.size() + n->out_pins.size());
+                layout.pin_offsets.resize(layout.pin_offsets.size() + result.pin_count, vector2_t{0, 0});
+                for (auto pins : {&n->in_pins, &n->out_pins})
+                {
+                    for (auto p : *pins)
+                    {
+                        if (p->id < result.pin_count)
+                        {
+                            layout.pin_offsets[result.first_pin + p->id] = p->offset;
+                        }
+                    }
+                }
+                if (n == anchor)
+                {
+                    layout.anchor = static_cast<uint32_t>(layout.nodes.size());
+                }
+                layout.nodes.push_back(result);
+                if (n->graph)
+                {
+                    capture_graph(n->graph, origin, anchor, layout);
+                }
+            }
+        }
+
+        // Walks graph in capture order, checking the shape and finding the anchor first, writing the results on a second walk.
+        bool apply_graph(graph_t* graph, vector2_t origin, bool write, const cached_layout_t& layout, size_t& graph_index, size_t& node_index, node_t*& anchor)
+        {
+            if (graph_index >= layout.bounds.size())
+            {
+                return false;
+            }
+            if (write)
+            {
+                graph->pending_offset = vector2_t{0, 0};
+                graph->bound = layout.bounds[graph_index].offset_by(origin);
+            }
+            else
+            {
+                graph->resolve_offset();
+            }
+            graph_index++;
+            if (auto disconnected = dynamic_cast<disconnected_graph_t*>(graph))
+            {
+                for (auto component : disconnected->get_connected_graphs())
+                {
+                    if (!apply_graph(component, origin, write, layout, graph_index, node_index, anchor))
+                    {
+                        return false;
+                    }
+                }
+                return true;
+            }
+            for (auto n : graph->nodes)
+            {
+                if (n->is_dummy_node)
+                {
+                    continue;
+                }
+                if (node_index >= layout.nodes.size())
+                {
+                    return false;
+                }
+                if (node_index == layout.anchor)
+                {
+                    anchor = n;
+                }
+                const auto& result = layout.nodes[node_index++];
+                if (result.pin_count != n->in_pins.size() + n->out_pins.size())
+                {
+                    return false;
+                }
+                for (auto pins : {&n->in_pins, &n->out_pins})
+                {
+                    for (auto p : *pins)
+                    {
+                        if (p->id >= result.pin_count)
+                        {
+                            return false;
+                        }
+                        if (write)
+                        {
+                            p->offset = layout.pin_offsets[result.first_pin + p->id];
+                        }
+                    }
+                }
+                if (write)
+                {
+                    n->position = origin + result.position;
+                    n->size = result.size;
+                    n->rank = result.rank;
+                }
+                if (n->graph)
+                {
+                    if (!apply_graph(n->graph, origin, write, layout, graph_index, node_index, anchor))
+                    {
+                        return false;
+                    }
+                    if (write)
+                    {
+                        // Same pin order as node_t::update_pins_offset() leaves behind.
+                        auto comparer = [](const pin_t* a, const pin_t* b)
+                        {
+                            return a->offset.y < b->offset.y;
+                        };
+                        sort(n->in_pins.begin(), n->in_pins.end(), comparer);
+                        sort(n->out_pins.begin(), n->out_pins.end(), comparer);
+                    }
+                }
+            }
+            return true;
+        }
+    }
+
+    uint64_t structural_hash(const graph_t* graph)
+    {
+        hasher_t hasher;
+        hash_graph(graph, hasher);
+        return hasher.value;
+    }
+
+    std::shared_ptr<cached_layout_t> cached_layout_t::capture(graph_t* graph, const node_t* anchor)
+    {
+        auto layout = make_shared<cached_layout_t>();
+        capture_graph(graph, anchor->position, anchor, *layout);
+        return layout;
+    }
+
+    node_t* cached_layout_t::apply(graph_t* graph) const
+    {
+        node_t* anchor_node = nullptr;
+        size_t graph_index = 0;
+        size_t node_index = 0;
+        if (!apply_graph(graph, vector2_t{0, 0}, false, *this, graph_index, node_index, anchor_node) || graph_index != bounds.size() || node_index != nodes.size() || !anchor_node)
+        {
+            return nullptr;
+        }
+        graph_index = 0;
+        node_index = 0;
+        apply_graph(graph, anchor_node->position, true, *this, graph_index, node_index, anchor_node);
+        return anchor_node;
+    }
+
+    layout_cache_t::layout_cache_t(size_t capacity, layout_store_t* store)
+        : capacity(max<size_t>(capacity, 1))
+        , store(store)
+    {
+    }
+
+    std::shared_ptr<const cached_layout_t> layout_cache_t::find(uint64_t key)
+    {
+        lock_guard<std::mutex> lock(mutex);
+        auto it = index.find(key);
+        if (it == index.end())
+        {
+            shared_ptr<const cached_layout_t> layout = store ? store->find(key) : nullptr;
+            if (!layout)
+            {
+                miss_count++;
+                return nullptr;
+            }
+            hit_count++;
+            insert_locked(key, layout);
+            return layout;
+        }
+        hit_count++;
+        entries.splice(entries.begin(), entries, it->second);
+        return it->second->second;
+    }
+
+    void layout_cache_t::insert(uint64_t key, std::shared_ptr<const cached_layout_t> layout)
+    {
+        lock_guard<std::mutex> lock(mutex);
+        if (store && layout)
+        {
+            store->append(key, *layout);
+        }
+        insert_locked(key, std::move(layout));
+    }
+
+    void layout_cache_t::insert_locked(uint64_t key, std::shared_ptr<const cached_layout_t> layout)
+    {
+        auto it = index.find(key);
+        if (it != index.end())
+        {
+            it->second->second = std::move(layout);
+            entries.splice(entries.begin(), entries, it->second);
+            return;
+        }
+        entries.emplace_front(key, std::move(layout));
+        index[key] = entries.begin();
+        if (entries.size() > capacity)
+        {
+            index.erase(entries.back().first);
+            entries.pop_back();
+        }
+    }
+
+    void layout_cache_t::clear()
+    {
+        lock_guard<std::mutex> lock(mutex);
+        entries.clear();
+        index.clear();
+    }
+
+    size_t layout_cache_t::size() const
+    {
+        lock_guard<std::mutex> lock(mutex);
+        return entries.size();
+    }
+
+    size_t layout_cache_t::hits() const
+    {
+        lock_guard<std::mutex> lock(mutex);
+        return hit_count;
+    }
+
+    size_t layout_cache_t::misses() const
+    {
+        lock_guard<std::mutex> lock(mutex);
+        return miss_count;
+    }
+}
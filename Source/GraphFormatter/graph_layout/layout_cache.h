@@ -0,0 +1,83 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Howaajin. All rights reserved.
+ *  Licensed under the MIT License. See License in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+
+#pragma once
+
+#include "graph_layout.h"
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace graph_layout
+{
+    class layout_store_t;
+
+    // Hash of everything a layout depends on: node sizes, pin types and offsets, edges with their weight and
+    // minimum length, rank slots, nested sub graphs with their borders, spacing, orientation and iterations.
+    // Nodes and pins are identified by their position in the graph, never by address, and positions are left
+    // out, so the same structure built again hashes the same.
+    uint64_t structural_hash(const graph_t* graph);
+
+    // Results of an arranged graph and all of its sub graphs, depth first in nodes order.
+    // Positions and bounds are relative to the node that keeps its place during the layout.
+    struct cached_layout_t
+    {
+        struct node_result_t
+        {
+            vector2_t position;
+            vector2_t size;
+            int rank;
+            uint32_t first_pin;
+            uint32_t pin_count;
+        };
+
+        // Index of the anchor node in nodes.
+        uint32_t anchor = 0;
+        std::vector<rect_t> bounds;
+        std::vector<node_result_t> nodes;
+        // Pin offsets by pin id.
+        std::vector<vector2_t> pin_offsets;
+
+        // Records the results of graph, anchor is the node that kept its position.
+        static std::shared_ptr<cached_layout_t> capture(graph_t* graph, const node_t* anchor);
+        // Writes the results into a graph of the same structure and returns the node that kept its position,
+        // nullptr when the shape doesn't match.
+        node_t* apply(graph_t* graph) const;
+    };
+
+    // Least recently used layouts by structural hash. Shared by every graph that points to it,
+    // lookups from graphs arranged concurrently are serialized. With a store, misses are looked up
+    // on disk and every inserted layout is also written there.
+    class layout_cache_t
+    {
+    public:
+        explicit layout_cache_t(size_t capacity = 256, layout_store_t* store = nullptr);
+
+        std::shared_ptr<const cached_layout_t> find(uint64_t key);
+        void insert(uint64_t key, std::shared_ptr<const cached_layout_t> layout);
+        void clear();
+        size_t size() const;
+        size_t hits() const;
+        size_t misses() const;
+
+    private:
+        void insert_locked(uint64_t key, std::shared_ptr<const cached_layout_t> layout);
+
+        using entry_t = std::pair<uint64_t, std::shared_ptr<const cached_layout_t>>;
+
+        size_t capacity;
+        layout_store_t* store;
+        mutable std::mutex mutex;
+        // Most recently used first.
+        std::list<entry_t> entries;
+        std::unordered_map<uint64_t, std::list<entry_t>::iterator> index;
+        size_t hit_count = 0;
+        size_t miss_count = 0;
+    };
+}
@@ -0,0 +1,443 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Howaajin. All rights reserved.
+ *  Licensed under the MIT License. See License in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+
+#include "layout_session.h"
+
+#include <algorithm>
+#include <limits>
+#include <memory>
+
+namespace graph_layout
+{
+    using namespace std;
+
+    layout_session_t::layout_session_t(vector2_t spacing, bool is_vertical_layout)
+        : spacing(spacing)
+        , is_vertical_layout(is_vertical_layout)
+    {
+    }
+
+    bool layout_session_t::apply(const layout_edit_t& edit)
+    {
+        switch (edit.kind)
+        {
+        case layout_edit_kind_t::add_node:
+            if (has_node(edit.node))
+            {
+                return false;
+            }
+            nodes[edit.node].size = edit.size;
+            return true;
+        case layout_edit_kind_t::remove_node:
+            if (!has_node(edit.node))
+            {
+                return false;
+            }
+            for (auto it = edges.begin(); it != edges.end();)
+            {
+                auto [tail, head] = it->first;
+                if (tail == edit.node || head == edit.node)
+                {
+                    nodes[tail == edit.node ? head : tail].is_changed = true;
+                    it = edges.erase(it);
+                }
+                else
+                {
+                    ++it;
+                }
+            }
+            nodes.erase(edit.node);
+            return true;
+        case layout_edit_kind_t::add_edge:
+            if (!has_node(edit.node) || !has_node(edit.head) || edit.node == edit.head || edges.count(make_pair(edit.node, edit.head)))
+            {
+                return false;
+            }
+            edges[make_pair(edit.node, edit.head)] = false;
+            nodes[edit.node].is_changed = true;
+            nodes[edit.head].is_changed = true;
+            return true;
+        case layout_edit_kind_t::remove_edge:
+            if (edges.erase(make_pair(edit.node, edit.head)) == 0)
+            {
+                return false;
+            }
+            nodes[edit.node].is_changed = true;
+            nodes[edit.head].is_changed = true;
+            return true;
+        case layout_edit_kind_t::resize_node:
+            if (!has_node(edit.node))
+            {
+                return false;
+            }
+            nodes[edit.node].size = edit.size;
+            nodes[edit.node].is_changed = true;
+            return true;
+        }
+        return false;
+    }
+
+    bool layout_session_t::apply(const std::vector<layout_edit_t>& edits)
+    {
+        bool applied = true;
+        for (const auto& edit : edits)
+        {
+            applied = apply(edit) && applied;
+        }
+        return applied;
+    }
+
+    void layout_session_t::arrange()
+    {
+        incremental_count = 0;
+        full_count = 0;
+        seeded_count = 0;
+        if (nodes.empty())
+        {
+            bound = rect_t{0, 0, 0, 0};
+            return;
+        }
+
+        // The graph is built again every time, only the results of the last layout are kept.
+        graph_t graph;
+        graph.spacing = spacing;
+        graph.is_vertical_layout = is_vertical_layout;
+        graph.layout_session = this;
+        unordered_map<size_t, node_t*> created;
+        for (auto& [key, state] : nodes)
+        {
+            node_t* n = graph.add_node();
+            n->size = state.size;
+            n->position = state.position;
+            pin_t* in_pin = n->add_pin(pin_type_t::in);
+            pin_t* out_pin = n->add_pin(pin_type_t::out);
+            if (is_vertical_layout)
+            {
+                in_pin->offset = vector2_t{state.size.x / 2, 0};
+                out_pin->offset = vector2_t{state.size.x / 2, state.size.y};
+            }
+            else
+            {
+                in_pin->offset = vector2_t{0, state.size.y / 2};
+                out_pin->offset = vector2_t{state.size.x, state.size.y / 2};
+            }
+            keys[n] = key;
+            created[key] = n;
+        }
+        for (auto& [ends, is_laid_out] : edges)
+        {
+            graph.add_edge(created[ends.first]->out_pins[0], created[ends.second]->in_pins[0]);
+        }
+
+        // The first node that didn't change is kept where it was, so an edit doesn't move the whole graph.
+        auto reference = find_if(nodes.begin(), nodes.end(), [](const auto& item) { return !item.second.is_changed && item.second.rank >= 0; });
+        const vector2_t reference_position = reference != nodes.end() ? reference->second.position : vector2_t{0, 0};
+
+        unique_ptr<graph_t> arranged(graph.to_connected_or_disconnected());
+        arranged->arrange();
+        arranged->visit_bounds([this](node_t* n, const rect_t& rect)
+        {
+            auto it = keys.find(n);
+            if (it != keys.end())
+            {
+                nodes[it->second].position = vector2_t{rect.l, rect.t};
+            }
+        });
+        const vector2_t offset = reference != nodes.end() ? reference_position - reference->second.position : vector2_t{0, 0};
+        for (auto& [key, state] : nodes)
+        {
+            state.position = state.position + offset;
+        }
+        bound = arranged->bound.offset_by(offset);
+
+        for (auto& [key, state] : nodes)
+        {
+            state.is_changed = false;
+        }
+        for (auto& [ends, is_laid_out] : edges)
+        {
+            is_laid_out = true;
+        }
+        dummy_orders.swap(next_dummy_orders);
+        next_dummy_orders.clear();
+        keys.clear();
+    }
+
+    rect_t layout_session_t::get_bound(size_t node) const
+    {
+        auto it = nodes.find(node);
+        if (it == nodes.end())
+        {
+            return rect_t{0, 0, 0, 0};
+        }
+        const auto& state = it->second;
+        return rect_t{state.position.x, state.position.y, state.position.x + state.size.x, state.position.y + state.size.y};
+    }
+
+    bool layout_session_t::arrange_incrementally(connected_graph_t* graph)
+    {
+        size_t changed = 0;
+        size_t component = 0;
+        for (auto n : graph->nodes)
+        {
+            auto it = keys.find(n);
+            if (it == keys.end())
+            {
+                full_count++;
+                return false;
+            }
+            const auto& state = nodes.at(it->second);
+            if (state.rank < 0 || state.is_changed)
+            {
+                changed++;
+            }
+            else if (component == 0)
+            {
+                component = state.component;
+            }
+            else if (component != state.component)
+            {
+                // Parts of different components were ranked and ordered apart from each other.
+                full_count++;
+                return false;
+            }
+        }
+        if (component == 0 || static_cast<float>(changed) > max_changed_ratio * static_cast<float>(graph->nodes.size()))
+        {
+            full_count++;
+            return false;
+        }
+
+        // Edges of the last layout point the same way as then, new ones are inverted only when they close a cycle.
+        vector<edge_t*> all_edges;
+        for (auto& [key, e] : graph->edges)
+        {
+            all_edges.push_back(e);
+        }
+        edge_mask_t undecided;
+        vector<edge_t*> new_edges;
+        for (auto e : all_edges)
+        {
+            const size_t tail = key_of(e->tail->owner);
+            const size_t head = key_of(e->head->owner);
+            if (edges.at(make_pair(tail, head)))
+            {
+                if (nodes.at(head).rank < nodes.at(tail).rank)
+                {
+                    graph->invert_edge(e);
+                }
+            }
+            else
+            {
+                new_edges.push_back(e);
+                undecided.mask(e);
+            }
+        }
+        for (auto e : new_edges)
+        {
+            if (undecided.is_descendant_of(e->tail->owner, e->head->owner))
+            {
+                graph->invert_edge(e);
+            }
+            undecided.masked_edges.erase(e);
+        }
+
+        // Old nodes keep their rank unless an edge pushes them down, new ones go right below their tails.
+        unordered_map<const node_t*, size_t> in_degrees;
+        vector<node_t*> sorted;
+        for (auto n : graph->nodes)
+        {
+            in_degrees[n] = n->in_edges.size();
+            if (n->in_edges.empty())
+            {
+                sorted.push_back(n);
+            }
+        }
+        for (size_t i = 0; i < sorted.size(); i++)
+        {
+            for (auto e : sorted[i]->out_edges)
+            {
+                node_t* head = e->head->owner;
+                if (--in_degrees[head] == 0)
+                {
+                    sorted.push_back(head);
+                }
+            }
+        }
+        int min_rank = numeric_limits<int>::max();
+        for (auto n : sorted)
+        {
+            const auto& state = nodes.at(key_of(n));
+            int rank = state.rank >= 0 ? state.rank : numeric_limits<int>::min();
+            for (auto e : n->in_edges)
+            {
+                rank = max(rank, e->tail->owner->rank + e->min_length);
+            }
+            if (rank == numeric_limits<int>::min())
+            {
+                // A new source goes right above the old nodes it points to.
+                for (auto e : n->out_edges)
+                {
+                    const auto& head_state = nodes.at(key_of(e->head->owner));
+                    if (head_state.rank >= 0)
+                    {
+                        rank = rank == numeric_limits<int>::min() ? head_state.rank - e->min_length : min(rank, head_state.rank - e->min_length);
+                    }
+                }
+            }
+            n->rank = rank == numeric_limits<int>::min() ? 0 : rank;
+            min_rank = min(min_rank, n->rank);
+        }
+        for (auto n : graph->nodes)
+        {
+            n->rank -= min_rank;
+        }
+
+        graph->add_dummy_nodes(nullptr);
+        graph->assign_layers();
+
+        // Old nodes and dummies take their old order, new ones go to the middle of their neighbors above.
+        unordered_map<const node_t*, dummy_key_t> dummy_keys;
+        collect_dummy_keys(graph, dummy_keys);
+        unordered_map<const node_t*, float> placed;
+        for (auto& layer : graph->layers)
+        {
+            vector<pair<float, node_t*>> keyed;
+            for (auto n : layer)
+            {
+                float order = -1;
+                if (n->is_dummy_node)
+                {
+                    auto it = dummy_keys.find(n);
+                    auto old = it != dummy_keys.end() ? dummy_orders.find(it->second) : dummy_orders.end();
+                    if (old != dummy_orders.end())
+                    {
+                        order = old->second;
+                    }
+                }
+                else
+                {
+                    const auto& state = nodes.at(key_of(n));
+                    if (state.rank >= 0)
+                    {
+                        order = state.order;
+                    }
+                }
+                if (order < 0)
+                {
+                    float sum = 0;
+                    size_t count = 0;
+                    for (auto e : n->in_edges)
+                    {
+                        auto it = placed.find(e->tail->owner);
+                        if (it != placed.end())
+                        {
+                            sum += it->second;
+                            count++;
+                        }
+                    }
+                    order = count > 0 ? sum / static_cast<float>(count) : static_cast<float>(layer.size());
+                }
+                keyed.emplace_back(order, n);
+            }
+            stable_sort(keyed.begin(), keyed.end(), [](const pair<float, node_t*>& a, const pair<float, node_t*>& b) { return a.first < b.first; });
+            for (size_t i = 0; i < keyed.size(); i++)
+            {
+                layer[i] = keyed[i].second;
+                placed[layer[i]] = static_cast<float>(i);
+            }
+        }
+
+        const size_t max_iterations = graph->max_iterations;
+        graph->max_iterations = ordering_iterations;
+        graph->ordering();
+        graph->max_iterations = max_iterations;
+        incremental_count++;
+        return true;
+    }
+
+    bool layout_session_t::get_rank_seed(const connected_graph_t* graph, rank_seed_t& seed)
+    {
+        seed.ranks.clear();
+        seed.tree_edges.clear();
+        for (auto n : graph->nodes)
+        {
+            auto it = keys.find(n);
+            if (it != keys.end() && nodes.at(it->second).rank >= 0)
+            {
+                seed.ranks[n] = nodes.at(it->second).rank;
+            }
+        }
+        if (seed.ranks.empty())
+        {
+            return false;
+        }
+        seeded_count++;
+        return true;
+    }
+
+    void layout_session_t::record(const connected_graph_t* graph)
+    {
+        const size_t component = next_component++;
+        unordered_map<const node_t*, dummy_key_t> dummy_keys;
+        collect_dummy_keys(graph, dummy_keys);
+        for (const auto& layer : graph->layers)
+        {
+            for (size_t i = 0; i < layer.size(); i++)
+            {
+                const node_t* n = layer[i];
+                if (n->is_dummy_node)
+                {
+                    auto it = dummy_keys.find(n);
+                    if (it != dummy_keys.end())
+                    {
+                        next_dummy_orders[it->second] = static_cast<float>(i);
+                    }
+                    continue;
+                }
+                auto it = keys.find(n);
+                if (it == keys.end())
+                {
+                    continue;
+                }
+                auto& state = nodes.at(it->second);
+                state.rank = n->rank;
+                state.order = static_cast<float>(i);
+                state.component = component;
+            }
+        }
+    }
+
+    void layout_session_t::collect_dummy_keys(const connected_graph_t* graph, std::unordered_map<const node_t*, dummy_key_t>& dummy_keys) const
+    {
+        for (auto n : graph->nodes)
+        {
+            if (n->is_dummy_node || keys.find(n) == keys.end())
+            {
+                continue;
+            }
+            for (auto e : n->out_edges)
+            {
+                vector<const node_t*> chain;
+                const node_t* next = e->head->owner;
+                while (next->is_dummy_node && next->out_edges.size() == 1)
+                {
+                    chain.push_back(next);
+                    next = next->out_edges[0]->head->owner;
+                }
+                if (chain.empty() || next->is_dummy_node || keys.find(next) == keys.end())
+                {
+                    continue;
+                }
+                const size_t tail = key_of(n);
+                const size_t head = key_of(next);
+                for (size_t i = 0; i < chain.size(); i++)
+                {
+                    dummy_keys[chain[i]] = dummy_key_t{tail, head, static_cast<int>(i)};
+                }
+            }
+        }
+    }
+}
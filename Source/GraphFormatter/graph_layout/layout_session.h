@@ -0,0 +1,108 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Howaajin. All rights reserved.
+ *  Licensed under the MIT License. See License in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+
+#pragma once
+
+#include "graph_layout.h"
+
+#include <map>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+namespace graph_layout
+{
+    enum class layout_edit_kind_t
+    {
+        add_node,
+        remove_node,
+        add_edge,
+        remove_edge,
+        resize_node,
+    };
+
+    // Nodes are identified by keys the caller chooses, edges by the keys of their ends.
+    struct layout_edit_t
+    {
+        layout_edit_kind_t kind = layout_edit_kind_t::add_node;
+        // The node, or the tail of the edge.
+        size_t node = 0;
+        size_t head = 0;
+        // Size of added and resized nodes.
+        vector2_t size{50, 50};
+    };
+
+    // Keeps a graph and its last layout between edits. A component with only a few changed nodes keeps the
+    // ranks and layer orders it had, new edges are only inverted when they close a cycle, ranks are pushed
+    // down as far as the new edges need and new nodes are put next to their neighbors before a few ordering
+    // sweeps. Coordinates are assigned again from those. Components with more changes, or made of parts of
+    // several old ones, are laid out from scratch. Nodes that didn't change keep their place on screen.
+    // Not thread safe, graphs of a session are arranged on the calling thread.
+    class layout_session_t
+    {
+    public:
+        explicit layout_session_t(vector2_t spacing = {80, 80}, bool is_vertical_layout = false);
+
+        // Fails on edits that don't fit the graph, like an edge to a missing node.
+        bool apply(const layout_edit_t& edit);
+        bool apply(const std::vector<layout_edit_t>& edits);
+        void arrange();
+
+        bool has_node(size_t node) const { return nodes.find(node) != nodes.end(); }
+        // Bound of node after the last arrange().
+        rect_t get_bound(size_t node) const;
+        size_t get_node_count() const { return nodes.size(); }
+        size_t get_edge_count() const { return edges.size(); }
+
+        // Components with a larger share of changed nodes are laid out from scratch.
+        float max_changed_ratio = 0.1f;
+        // Ordering sweeps after the retained orders are restored.
+        size_t ordering_iterations = 4;
+        rect_t bound{0, 0, 0, 0};
+        // Components laid out from the last layout and from scratch by the last arrange().
+        size_t incremental_count = 0;
+        size_t full_count = 0;
+        // Components laid out from scratch whose network simplex started from the ranks of the last layout.
+        size_t seeded_count = 0;
+
+        // Called by connected_graph_t::arrange(), ranks and orders graph when the last layout can be reused.
+        bool arrange_incrementally(connected_graph_t* graph);
+        // Called by connected_graph_t::arrange() before ranking from scratch. Ranks of the last layout of the nodes
+        // of graph that had one, false when none had.
+        bool get_rank_seed(const connected_graph_t* graph, rank_seed_t& seed);
+        // Called by connected_graph_t::arrange() with the final layers.
+        void record(const connected_graph_t* graph);
+
+    private:
+        struct node_state_t
+        {
+            vector2_t size{50, 50};
+            vector2_t position{0, 0};
+            // Rank and index in the layer of the last layout, -1 before the first one.
+            int rank = -1;
+            float order = 0;
+            size_t component = 0;
+            bool is_changed = true;
+        };
+
+        // Dummy nodes are identified by the keys of the edge they stand for and their place along it.
+        using dummy_key_t = std::tuple<size_t, size_t, int>;
+
+        size_t key_of(const node_t* node) const { return keys.at(node); }
+        // Keys of the dummy nodes of graph, found by walking the chains from their real tail.
+        void collect_dummy_keys(const connected_graph_t* graph, std::unordered_map<const node_t*, dummy_key_t>& dummy_keys) const;
+
+        vector2_t spacing;
+        bool is_vertical_layout;
+        std::map<size_t, node_state_t> nodes;
+        // Edges by tail and head, true when the last layout had them.
+        std::map<std::pair<size_t, size_t>, bool> edges;
+        std::map<dummy_key_t, float> dummy_orders;
+        std::map<dummy_key_t, float> next_dummy_orders;
+        // Keys of the nodes of the graph being arranged.
+        std::unordered_map<const node_t*, size_t> keys;
+        size_t next_component = 1;
+    };
+}
@@ -0,0 +1,607 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Howaajin. All rights reserved.
+ *  Licensed under the MIT License. See License in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+
+#include "layout_store.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <random>
+#include <vector>
+
+namespace graph_layout
+{
+    using namespace std;
+    namespace fs = std::filesystem;
+
+    static_assert(sizeof(layout_log_header_t) == 16, "layout_log_header_t must be packed");
+    static_assert(sizeof(layout_record_header_t) == 24, "layout_record_header_t must be packed");
+    static_assert(sizeof(layout_index_header_t) == 32, "layout_index_header_t must be packed");
+    static_assert(sizeof(layout_index_slot_t) == 16, "layout_index_slot_t must be packed");
+    static_assert(sizeof(cached_layout_t::node_result_t) == 28, "node_result_t must be packed");
+
+    namespace
+    {
+        constexpr uint32_t record_magic = 0x524C4C47; // "GLLR"
+
+        uint32_t checksum_of(uint64_t key, const uint8_t* data, size_t size)
+        {
+            uint32_t hash = 2166136261u;
+            auto add = [&hash](const uint8_t* bytes, size_t count)
+            {
+                for (size_t i = 0; i < count; i++)
+                {
+                    hash = (hash ^ bytes[i]) * 16777619u;
+                }
+            };
+            add(reinterpret_cast<const uint8_t*>(&key), sizeof(key));
+            add(data, size);
+            return hash;
+        }
+
+        // Payload: anchor, bound count, node count, pin count, then the three arrays.
+        vector<uint8_t> encode(const cached_layout_t& layout)
+        {
+            const uint32_t counts[4] = {
+                layout.anchor,
+                static_cast<uint32_t>(layout.bounds.size()),
+                static_cast<uint32_t>(layout.nodes.size()),
+                static_cast<uint32_t>(layout.pin_offsets.size()),
+            };
+            const size_t bounds_bytes = layout.bounds.size() * sizeof(rect_t);
+            const size_t nodes_bytes = layout.nodes.size() * sizeof(cached_layout_t::node_result_t);
+            const size_t pins_bytes = layout.pin_offsets.size() * sizeof(vector2_t);
+            vector<uint8_t> payload(sizeof(counts) + bounds_bytes + nodes_bytes + pins_bytes);
+            uint8_t* p = payload.data();
+            memcpy(p, counts, sizeof(counts));
+            p += sizeof(counts);
+            memcpy(p, layout.bounds.data(), bounds_bytes);
+            p += bounds_bytes;
+            memcpy(p, layout.nodes.data(), nodes_bytes);
+            p += nodes_bytes;
+            memcpy(p, layout.pin_offsets.data(), pins_bytes);
+            return payload;
+        }
+
+        shared_ptr<cached_layout_t> decode(const vector<uint8_t>& payload)
+        {
+            uint32_t counts[4];
+            if (payload.size() < sizeof(counts))
+            {
+                return nullptr;
+            }
+            memcpy(counts, payload.data(), sizeof(counts));
+            const uint64_t bounds_bytes = static_cast<uint64_t>(counts[1]) * sizeof(rect_t);
+            const uint64_t nodes_bytes = static_cast<uint64_t>(counts[2]) * sizeof(cached_layout_t::node_result_t);
+            const uint64_t pins_bytes = static_cast<uint64_t>(counts[3]) * sizeof(vector2_t);
+            if (sizeof(counts) + bounds_bytes + nodes_bytes + pins_bytes != payload.size())
+            {
+                return nullptr;
+            }
+            auto layout = make_shared<cached_layout_t>();
+            layout->anchor = counts[0];
+            layout->bounds.resize(counts[1]);
+            layout->nodes.resize(counts[2]);
+            layout->pin_offsets.resize(counts[3]);
+            const uint8_t* p = payload.data() + sizeof(counts);
+            memcpy(layout->bounds.data(), p, bounds_bytes);
+            p += bounds_bytes;
+            memcpy(layout->nodes.data(), p, nodes_bytes);
+            p += nodes_bytes;
+            memcpy(layout->pin_offsets.data(), p, pins_bytes);
+            for (const auto& node : layout->nodes)
+            {
+                if (static_cast<uint64_t>(node.first_pin) + node.pin_count > layout->pin_offsets.size())
+                {
+                    return nullptr;
+                }
+            }
+            return layout;
+        }
+
+        uint64_t new_log_id()
+        {
+            random_device device;
+            const uint64_t time = static_cast<uint64_t>(chrono::steady_clock::now().time_since_epoch().count());
+            const uint64_t id = (static_cast<uint64_t>(device()) << 32 | device()) ^ time;
+            return id != 0 ? id : 1;
+        }
+    }
+
+    layout_store_t::layout_store_t(uint64_t max_bytes)
+        : max_bytes(max(max_bytes, uint64_t{4096}))
+    {
+    }
+
+    layout_store_t::~layout_store_t()
+    {
+        close();
+    }
+
+    bool layout_store_t::open(const std::string& path)
+    {
+        close();
+        lock_guard<std::mutex> lock(mutex);
+        this->path = path;
+        layout_log_header_t header{};
+        error_code ec;
+        log.open(path, ios::binary | ios::in | ios::out);
+        if (log.is_open())
+        {
+            log.read(reinterpret_cast<char*>(&header), sizeof(header));
+        }
+        if (!log || header.magic != layout_log_magic || header.version != layout_store_version)
+        {
+            // Missing, unreadable or from another version, start over.
+            log.close();
+            return create_log() && write_index();
+        }
+        log_id = header.log_id;
+        log_bytes = fs::file_size(path, ec);
+        if (ec)
+        {
+            log.close();
+            return false;
+        }
+        map_index();
+        if (index_header)
+        {
+            scan(index_header->log_bytes);
+        }
+        else
+        {
+            scan(sizeof(layout_log_header_t));
+        }
+        return log.is_open();
+    }
+
+    void layout_store_t::close()
+    {
+        lock_guard<std::mutex> lock(mutex);
+        if (log.is_open())
+        {
+            if (!recent.empty())
+            {
+                write_index();
+            }
+            log.close();
+        }
+        index.close();
+        index_header = nullptr;
+        index_slots = nullptr;
+        recent.clear();
+        log_bytes = 0;
+    }
+
+    bool layout_store_t::flush()
+    {
+        lock_guard<std::mutex> lock(mutex);
+        if (!log.is_open())
+        {
+            return false;
+        }
+        log.flush();
+        return recent.empty() || write_index();
+    }
+
+    std::shared_ptr<const cached_layout_t> layout_store_t::find(uint64_t key)
+    {
+        lock_guard<std::mutex> lock(mutex);
+        if (!log.is_open())
+        {
+            return nullptr;
+        }
+        const uint64_t offset = find_offset(key);
+        vector<uint8_t> payload;
+        if (offset == 0 || !read_record(offset, key, payload))
+        {
+            return nullptr;
+        }
+        auto layout = decode(payload);
+        if (layout && log_bytes - offset > max_bytes / 2)
+        {
+            // Would be dropped by the next compaction, keep it with the recent ones.
+            const uint64_t new_offset = write_record(key, payload);
+            if (new_offset != 0)
+            {
+                recent[key] = new_offset;
+            }
+            if (log_bytes > max_bytes)
+            {
+                compact();
+            }
+        }
+        return layout;
+    }
+
+    void layout_store_t::append(uint64_t key, const cached_layout_t& layout)
+    {
+        lock_guard<std::mutex> lock(mutex);
+        if (!log.is_open())
+        {
+            return;
+        }
+        const uint64_t offset = write_record(key, encode(layout));
+        if (offset != 0)
+        {
+            recent[key] = offset;
+        }
+        if (log_bytes > max_bytes)
+        {
+            compact();
+        }
+    }
+
+    bool layout_store_t::create_log()
+    {
+        log.open(path, ios::binary | ios::in | ios::out | ios::trunc);
+        if (!log.is_open())
+        {
+            return false;
+        }
+        log_id = new_log_id();
+        const layout_log_header_t header{layout_log_magic, layout_store_version, log_id};
+        log.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        log.flush();
+        log_bytes = sizeof(header);
+        recent.clear();
+        index.close();
+        index_header = nullptr;
+        index_slots = nullptr;
+        return static_cast<bool>(log);
+    }
+
+    void layout_store_t::map_index()
+    {
+        index_header = nullptr;
+        index_slots = nullptr;
+        if (!index.open(path + ".index") || index.size < sizeof(layout_index_header_t))
+        {
+            index.close();
+            return;
+        }
+        auto header = reinterpret_cast<const layout_index_header_t*>(index.data);
+        const bool valid = header->magic == layout_index_magic && header->version == layout_store_version && header->log_id == log_id &&
+            header->log_bytes >= sizeof(layout_log_header_t) && header->log_bytes <= log_bytes && header->slot_count > 0 &&
+            (header->slot_count & (header->slot_count - 1)) == 0 &&
+            index.size == sizeof(layout_index_header_t) + static_cast<uint64_t>(header->slot_count) * sizeof(layout_index_slot_t);
+        if (!valid)
+        {
+            index.close();
+            return;
+        }
+        index_header = header;
+        index_slots = reinterpret_cast<const layout_index_slot_t*>(index.data + sizeof(layout_index_header_t));
+    }
+
+    uint64_t layout_store_t::find_offset(uint64_t key) const
+    {
+        auto it = recent.find(key);
+        if (it != recent.end())
+        {
+            return it->second;
+        }
+        if (!index_header)
+        {
+            return 0;
+        }
+        const uint32_t mask = index_header->slot_count - 1;
+        for (uint32_t i = static_cast<uint32_t>(key) & mask, probes = 0; probes <= mask; i = (i + 1) & mask, probes++)
+        {
+            const auto& slot = index_slots[i];
+            if (slot.offset == 0)
+            {
+                return 0;
+            }
+            if (slot.key == key)
+            {
+                return slot.offset;
+            }
+        }
+        return 0;
+    }
+
+    bool layout_store_t::read_record(uint64_t offset, uint64_t key, std::vector<uint8_t>& payload)
+    {
+        if (offset + sizeof(layout_record_header_t) > log_bytes)
+        {
+            return false;
+        }
+        layout_record_header_t header{};
+        log.clear();
+        log.seekg(static_cast<streamoff>(offset));
+        log.read(reinterpret_cast<char*>(&header), sizeof(header));
+        if (!log || header.magic != record_magic || header.key != key || header.payload_bytes > log_bytes - offset - sizeof(header))
+        {
+            log.clear();
+            return false;
+        }
+        payload.resize(header.payload_bytes);
+        log.read(reinterpret_cast<char*>(payload.data()), header.payload_bytes);
+        const bool ok = static_cast<bool>(log) && checksum_of(key, payload.data(), payload.size()) == header.checksum;
+        log.clear();
+        return ok;
+    }
+
+    uint64_t layout_store_t::write_record(uint64_t key, const std::vector<uint8_t>& payload)
+    {
+        const layout_record_header_t header{record_magic, static_cast<uint32_t>(payload.size()), key, checksum_of(key, payload.data(), payload.size()), 0};
+        const uint64_t offset = log_bytes;
+        log.clear();
+        log.seekp(static_cast<streamoff>(offset));
+        log.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        log.write(reinterpret_cast<const char*>(payload.data()), static_cast<streamsize>(payload.size()));
+        log.flush();
+        if (!log)
+        {
+            log.clear();
+            return 0;
+        }
+        log_bytes += sizeof(header) + payload.size();
+        return offset;
+    }
+
+    void layout_store_t::scan(uint64_t from)
+    {
+        uint64_t offset = from;
+        vector<uint8_t> payload;
+        while (offset + sizeof(layout_record_header_t) <= log_bytes)
+        {
+            layout_record_header_t header{};
+            log.clear();
+            log.seekg(static_cast<streamoff>(offset));
+            log.read(reinterpret_cast<char*>(&header), sizeof(header));
+            if (!log || header.magic != record_magic || !read_record(offset, header.key, payload))
+            {
+                break;
+            }
+            recent[header.key] = offset;
+            offset += sizeof(header) + header.payload_bytes;
+        }
+        log.clear();
+        if (offset != log_bytes)
+        {
+            // The rest was torn by a crash, appending starts at the last complete record.
+            log.close();
+            error_code ec;
+            fs::resize_file(path, offset, ec);
+            log.open(path, ios::binary | ios::in | ios::out);
+            log_bytes = offset;
+        }
+    }
+
+    bool layout_store_t::write_index()
+    {
+        vector<layout_index_slot_t> entries;
+        if (index_header)
+        {
+            for (uint32_t i = 0; i < index_header->slot_count; i++)
+            {
+                const auto& slot = index_slots[i];
+                if (slot.offset != 0 && slot.offset < log_bytes && recent.find(slot.key) == recent.end())
+                {
+                    entries.push_back(slot);
+                }
+            }
+        }
+        for (auto [key, offset] : recent)
+        {
+            entries.push_back(layout_index_slot_t{key, offset});
+        }
+        uint32_t slot_count = 64;
+        while (slot_count < entries.size() * 2)
+        {
+            slot_count *= 2;
+        }
+        vector<layout_index_slot_t> slots(slot_count, layout_index_slot_t{0, 0});
+        // Inserted in log order, so the table is the same whatever order the entries were found in.
+        sort(entries.begin(), entries.end(), [](const layout_index_slot_t& a, const layout_index_slot_t& b) { return a.offset < b.offset; });
+        for (const auto& entry : entries)
+        {
+            uint32_t i = static_cast<uint32_t>(entry.key) & (slot_count - 1);
+            while (slots[i].offset != 0)
+            {
+                i = (i + 1) & (slot_count - 1);
+            }
+            slots[i] = entry;
+        }
+        const layout_index_header_t header{layout_index_magic, layout_store_version, slot_count, static_cast<uint32_t>(entries.size()), log_id, log_bytes};
+
+        // A complete new index replaces the old one, a crash leaves one or the other.
+        const string index_path = path + ".index";
+        const string temp_path = index_path + ".tmp";
+        {
+            ofstream file(temp_path, ios::binary | ios::trunc);
+            file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            file.write(reinterpret_cast<const char*>(slots.data()), static_cast<streamsize>(slots.size() * sizeof(layout_index_slot_t)));
+            if (!file)
+            {
+                return false;
+            }
+        }
+        index.close();
+        index_header = nullptr;
+        index_slots = nullptr;
+        error_code ec;
+        fs::rename(temp_path, index_path, ec);
+        map_index();
+        if (ec || !index_header)
+        {
+            return false;
+        }
+        recent.clear();
+        return true;
+    }
+
+    void layout_store_t::compact()
+    {
+        // Newest records first, until half of the limit is used.
+        vector<layout_index_slot_t> entries;
+        if (index_header)
+        {
+            for (uint32_t i = 0; i < index_header->slot_count; i++)
+            {
+                const auto& slot = index_slots[i];
+                if (slot.offset != 0 && recent.find(slot.key) == recent.end())
+                {
+                    entries.push_back(slot);
+                }
+            }
+        }
+        for (auto [key, offset] : recent)
+        {
+            entries.push_back(layout_index_slot_t{key, offset});
+        }
+        sort(entries.begin(), entries.end(), [](const layout_index_slot_t& a, const layout_index_slot_t& b) { return a.offset > b.offset; });
+        vector<pair<uint64_t, vector<uint8_t>>> kept;
+        uint64_t kept_bytes = sizeof(layout_log_header_t);
+        for (const auto& entry : entries)
+        {
+            vector<uint8_t> payload;
+            if (!read_record(entry.offset, entry.key, payload))
+            {
+                continue;
+            }
+            kept_bytes += sizeof(layout_record_header_t) + payload.size();
+            if (kept_bytes > max_bytes / 2)
+            {
+                break;
+            }
+            kept.emplace_back(entry.key, std::move(payload));
+        }
+
+        const string temp_path = path + ".tmp";
+        const uint64_t new_log_id_value = new_log_id();
+        vector<pair<uint64_t, uint64_t>> offsets;
+        {
+            ofstream file(temp_path, ios::binary | ios::trunc);
+            const layout_log_header_t header{layout_log_magic, layout_store_version, new_log_id_value};
+            file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            uint64_t offset = sizeof(header);
+            for (auto it = kept.rbegin(); it != kept.rend(); ++it)
+            {
+                const auto& [key, payload] = *it;
+                const layout_record_header_t record{record_magic, static_cast<uint32_t>(payload.size()), key, checksum_of(key, payload.data(), payload.size()), 0};
+                file.write(reinterpret_cast<const char*>(&record), sizeof(record));
+                file.write(reinterpret_cast<const char*>(payload.data()), static_cast<streamsize>(payload.size()));
+                offsets.emplace_back(key, offset);
+                offset += sizeof(record) + payload.size();
+            }
+            if (!file)
+            {
+                return;
+            }
+        }
+        // The old index doesn't match the new log id, a crash before it is rewritten only costs a scan.
+        log.close();
+        index.close();
+        index_header = nullptr;
+        index_slots = nullptr;
+        error_code ec;
+        fs::rename(temp_path, path, ec);
+        log.open(path, ios::binary | ios::in | ios::out);
+        layout_log_header_t header{};
+        log.read(reinterpret_cast<char*>(&header), sizeof(header));
+        log.clear();
+        log_id = header.log_id;
+        log_bytes = fs::file_size(path, ec);
+        recent.clear();
+        if (log_id == new_log_id_value)
+        {
+            for (auto [key, offset] : offsets)
+            {
+                recent[key] = offset;
+            }
+        }
+        else
+        {
+            scan(sizeof(layout_log_header_t));
+        }
+        write_index();
+    }
+
+    void test_layout_store()
+    {
+        const string path = (fs::temp_directory_path() / "graph_layout_store_test.gllc").string();
+        auto remove_files = [&path]()
+        {
+            error_code ec;
+            fs::remove(path, ec);
+            fs::remove(path + ".index", ec);
+        };
+        auto layout_at = [](float x)
+        {
+            cached_layout_t layout;
+            layout.bounds.push_back(rect_t{0, 0, x, x});
+            layout.nodes.push_back(cached_layout_t::node_result_t{vector2_t{x, 0}, vector2_t{50, 50}, 1, 0, 1});
+            layout.pin_offsets.push_back(vector2_t{0, x});
+            return layout;
+        };
+        auto is_at = [](const shared_ptr<const cached_layout_t>& layout, float x)
+        {
+            return layout && layout->nodes.size() == 1 && layout->nodes[0].position.x == x && layout->pin_offsets[0].y == x;
+        };
+        remove_files();
+
+        // Records are found through the index after reopening.
+        {
+            layout_store_t store;
+            assert(store.open(path));
+            store.append(1, layout_at(10));
+            store.append(2, layout_at(20));
+        }
+        {
+            layout_store_t store;
+            assert(store.open(path));
+            assert(is_at(store.find(1), 10) && is_at(store.find(2), 20) && !store.find(3));
+            store.append(3, layout_at(30));
+            store.append(4, layout_at(40));
+        }
+
+        // A record torn by a crash is cut off, the index no longer matching the log is rebuilt from it.
+        error_code ec;
+        const uintmax_t full_size = fs::file_size(path, ec);
+        fs::resize_file(path, full_size - 5, ec);
+        {
+            layout_store_t store;
+            assert(store.open(path));
+            assert(is_at(store.find(1), 10) && is_at(store.find(3), 30) && !store.find(4));
+            assert(store.size_in_bytes() < full_size - 5);
+            store.append(5, layout_at(50));
+        }
+        {
+            layout_store_t store;
+            assert(store.open(path));
+            assert(is_at(store.find(3), 30) && is_at(store.find(5), 50));
+
+            // A cache misses into the store and writes through to it.
+            layout_cache_t cache(4, &store);
+            assert(is_at(cache.find(5), 50) && cache.hits() == 1 && cache.misses() == 0);
+            cache.insert(6, make_shared<cached_layout_t>(layout_at(60)));
+            assert(is_at(store.find(6), 60));
+        }
+
+        // The log stays under its limit, the newest records survive and the oldest ones go.
+        remove_files();
+        {
+            layout_store_t store(4096);
+            assert(store.open(path));
+            for (uint64_t key = 1; key <= 200; key++)
+            {
+                store.append(key, layout_at(static_cast<float>(key)));
+                assert(store.size_in_bytes() <= 4096);
+            }
+            assert(is_at(store.find(200), 200) && !store.find(1));
+        }
+        {
+            layout_store_t store(4096);
+            assert(store.open(path));
+            assert(is_at(store.find(200), 200) && !store.find(1));
+        }
+        remove_files();
+    }
+}
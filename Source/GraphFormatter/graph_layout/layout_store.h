@@ -0,0 +1,113 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Howaajin. All rights reserved.
+ *  Licensed under the MIT License. See License in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+
+#pragma once
+
+#include "graph_file.h"
+#include "layout_cache.h"
+
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace graph_layout
+{
+    // Layouts kept on disk across sessions, in two files that can be shared between machines:
+    //   <path>        append-only log of checksummed records, each a structural hash and a cached_layout_t
+    //   <path>.index  open addressing table from hash to record offset, mapped read only
+    // Opening maps the index and only reads the part of the log the index doesn't cover yet, so it doesn't
+    // get slower as the cache grows. A record torn by a crash fails its checksum and is cut off, the index
+    // is replaced by renaming a complete new file over it and rebuilt from the log when it doesn't match.
+    // When the log grows past max_bytes it is rewritten with the newest records that fit in half of it,
+    // records hit while in the older half are appended again first, so the ones in use survive.
+    // All files are little-endian.
+    constexpr uint32_t layout_log_magic = 0x434C4C47; // "GLLC"
+    constexpr uint32_t layout_index_magic = 0x494C4C47; // "GLLI"
+    constexpr uint32_t layout_store_version = 2;
+
+    struct layout_log_header_t
+    {
+        uint32_t magic;
+        uint32_t version;
+        // Changes whenever the log is rewritten, an index of another log is never used.
+        uint64_t log_id;
+    };
+
+    struct layout_record_header_t
+    {
+        uint32_t magic;
+        uint32_t payload_bytes;
+        uint64_t key;
+        // FNV-1a of the key and the payload.
+        uint32_t checksum;
+        uint32_t reserved;
+    };
+
+    struct layout_index_header_t
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t slot_count;
+        uint32_t entry_count;
+        uint64_t log_id;
+        // Records before this offset are in the table.
+        uint64_t log_bytes;
+    };
+
+    struct layout_index_slot_t
+    {
+        uint64_t key;
+        // Zero marks an empty slot, records never start there.
+        uint64_t offset;
+    };
+
+    class layout_store_t
+    {
+    public:
+        explicit layout_store_t(uint64_t max_bytes = 64ull << 20);
+        layout_store_t(const layout_store_t&) = delete;
+        layout_store_t& operator=(const layout_store_t&) = delete;
+        ~layout_store_t();
+
+        // Opens or creates the log at path.
+        bool open(const std::string& path);
+        // Writes the index and closes the files.
+        void close();
+        // Makes the index cover the whole log.
+        bool flush();
+        std::shared_ptr<const cached_layout_t> find(uint64_t key);
+        void append(uint64_t key, const cached_layout_t& layout);
+        bool is_open() const { return log.is_open(); }
+        uint64_t size_in_bytes() const { return log_bytes; }
+
+    private:
+        bool create_log();
+        void map_index();
+        uint64_t find_offset(uint64_t key) const;
+        bool read_record(uint64_t offset, uint64_t key, std::vector<uint8_t>& payload);
+        uint64_t write_record(uint64_t key, const std::vector<uint8_t>& payload);
+        void scan(uint64_t from);
+        bool write_index();
+        void compact();
+
+        uint64_t max_bytes;
+        std::string path;
+        std::fstream log;
+        uint64_t log_id = 0;
+        uint64_t log_bytes = 0;
+        mapped_file_t index;
+        const layout_index_header_t* index_header = nullptr;
+        const layout_index_slot_t* index_slots = nullptr;
+        // Records the mapped index doesn't have yet.
+        std::unordered_map<uint64_t, uint64_t> recent;
+        std::mutex mutex;
+    };
+
+    // Reopening, torn records, a cache in front of a store and compaction, asserts on failure.
+    void test_layout_store();
+}
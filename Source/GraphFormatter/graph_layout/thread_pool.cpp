@@ -0,0 +1,208 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Howaajin. All rights reserved.
+ *  Licensed under the MIT License. See License in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+
+#include "thread_pool.h"
+
+#include <algorithm>
+
+namespace graph_layout
+{
+    using namespace std;
+
+    namespace
+    {
+        struct worker_identity_t
+        {
+            const thread_pool_t* pool = nullptr;
+            size_t index = 0;
+        };
+
+        thread_local worker_identity_t current_identity;
+    }
+
+    thread_pool_t::thread_pool_t(size_t thread_count)
+    {
+        if (thread_count == 0)
+        {
+            thread_count = max(1u, thread::hardware_concurrency());
+        }
+        for (size_t i = 0; i < thread_count; i++)
+        {
+            workers.push_back(make_unique<worker_t>());
+        }
+        for (size_t i = 0; i < thread_count; i++)
+        {
+            workers[i]->thread = thread([this, i]() { work(i); });
+        }
+    }
+
+    thread_pool_t::~thread_pool_t()
+    {
+        {
+            lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        task_ready.notify_all();
+        for (auto& worker : workers)
+        {
+            worker->thread.join();
+        }
+    }
+
+    size_t thread_pool_t::current_worker() const
+    {
+        return current_identity.pool == this ? current_identity.index : workers.size();
+    }
+
+    void thread_pool_t::run(function<void()> task)
+    {
+        unfinished++;
+        {
+            // Counted under the lock idle workers check before sleeping, so the wake up isn't lost.
+            lock_guard<std::mutex> lock(mutex);
+            queued++;
+        }
+        const size_t index = current_worker();
+        if (index < workers.size())
+        {
+            lock_guard<std::mutex> lock(workers[index]->mutex);
+            workers[index]->tasks.push_back(std::move(task));
+        }
+        else
+        {
+            lock_guard<std::mutex> lock(mutex);
+            shared_tasks.push_back(std::move(task));
+        }
+        task_ready.notify_one();
+    }
+
+    bool thread_pool_t::pop_task(size_t index, function<void()>& task)
+    {
+        if (index < workers.size())
+        {
+            auto& own = *workers[index];
+            lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty())
+            {
+                task = std::move(own.tasks.back());
+                own.tasks.pop_back();
+                queued--;
+                return true;
+            }
+        }
+        {
+            lock_guard<std::mutex> lock(mutex);
+            if (!shared_tasks.empty())
+            {
+                task = std::move(shared_tasks.front());
+                shared_tasks.pop_front();
+                queued--;
+                return true;
+            }
+        }
+        const size_t count = workers.size();
+        for (size_t i = 1; i <= count; i++)
+        {
+            auto& victim = *workers[(index + i) % count];
+            lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty())
+            {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                queued--;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool thread_pool_t::try_run_one(size_t index)
+    {
+        function<void()> task;
+        if (!pop_task(index, task))
+        {
+            return false;
+        }
+        task();
+        if (--unfinished == 0)
+        {
+            lock_guard<std::mutex> lock(mutex);
+            all_done.notify_all();
+        }
+        return true;
+    }
+
+    void thread_pool_t::wait()
+    {
+        unique_lock<std::mutex> lock(mutex);
+        all_done.wait(lock, [this]() { return unfinished == 0; });
+    }
+
+    void thread_pool_t::parallel_for(size_t count, const function<void(size_t)>& body)
+    {
+        if (count == 0)
+        {
+            return;
+        }
+        struct job_t
+        {
+            atomic<size_t> next{0};
+            atomic<size_t> done{0};
+            std::mutex mutex;
+            condition_variable finished;
+        };
+        // Helpers may start after the loop is over, they only touch the shared job then, never body.
+        auto job = make_shared<job_t>();
+        auto take_items = [job, count, &body]()
+        {
+            size_t taken = 0;
+            for (size_t i = job->next++; i < count; i = job->next++)
+            {
+                body(i);
+                taken++;
+            }
+            if (taken > 0 && job->done.fetch_add(taken) + taken == count)
+            {
+                lock_guard<std::mutex> lock(job->mutex);
+                job->finished.notify_all();
+            }
+        };
+        const size_t helpers = min(count - 1, workers.size());
+        for (size_t i = 0; i < helpers; i++)
+        {
+            run(take_items);
+        }
+        take_items();
+
+        // Items still running elsewhere finish without this thread, help with other work meanwhile.
+        const size_t index = current_worker();
+        while (job->done != count)
+        {
+            if (!try_run_one(index))
+            {
+                unique_lock<std::mutex> lock(job->mutex);
+                job->finished.wait(lock, [&job, count]() { return job->done == count; });
+            }
+        }
+    }
+
+    void thread_pool_t::work(size_t index)
+    {
+        current_identity = worker_identity_t{this, index};
+        for (;;)
+        {
+            if (try_run_one(index))
+            {
+                continue;
+            }
+            unique_lock<std::mutex> lock(mutex);
+            task_ready.wait(lock, [this]() { return stopping || queued > 0; });
+            if (stopping && queued == 0)
+            {
+                return;
+            }
+        }
+    }
+}
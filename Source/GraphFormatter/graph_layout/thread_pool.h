@@ -0,0 +1,62 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Howaajin. All rights reserved.
+ *  Licensed under the MIT License. See License in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace graph_layout
+{
+    // Work-stealing thread pool. A task queued from a worker goes to the worker's own deque and is taken
+    // newest first, idle workers steal the oldest tasks of the others, tasks queued from other threads go
+    // to a shared queue. Nested parallel_for calls then balance deep and shallow branches of a task tree.
+    class thread_pool_t
+    {
+    public:
+        // Zero means one thread per hardware thread.
+        explicit thread_pool_t(size_t thread_count = 0);
+        thread_pool_t(const thread_pool_t&) = delete;
+        thread_pool_t& operator=(const thread_pool_t&) = delete;
+        ~thread_pool_t();
+
+        size_t size() const { return workers.size(); }
+        void run(std::function<void()> task);
+        // Blocks until every task queued so far has finished, not to be called from a task.
+        void wait();
+        // Calls body for every index in [0, count) and returns when all calls have finished.
+        // The calling thread takes part and runs other queued tasks while it waits, so it can be nested
+        // inside tasks without starving the pool.
+        void parallel_for(size_t count, const std::function<void(size_t)>& body);
+
+    private:
+        struct worker_t
+        {
+            std::mutex mutex;
+            std::deque<std::function<void()>> tasks;
+            std::thread thread;
+        };
+
+        void work(size_t index);
+        size_t current_worker() const;
+        bool pop_task(size_t index, std::function<void()>& task);
+        bool try_run_one(size_t index);
+
+        std::vector<std::unique_ptr<worker_t>> workers;
+        std::mutex mutex;
+        std::deque<std::function<void()>> shared_tasks;
+        std::condition_variable task_ready;
+        std::condition_variable all_done;
+        std::atomic<size_t> queued{0};
+        std::atomic<size_t> unfinished{0};
+        bool stopping = false;
+    };
+}
@@ -0,0 +1,528 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Howaajin. All rights reserved.
+ *  Licensed under the MIT License. See License in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+
+// Batch layout of serialized graphs, independent of the engine.
+//
+// Build, from the repository root:
+//   c++ -std=c++17 -O2 -ISource/GraphFormatter Tools/graph_layout_cli/graph_layout_cli.cpp
+//       Source/GraphFormatter/graph_layout/*.cpp -o graph_layout_cli -lpthread
+//
+// Usage:
+//   graph_layout_cli <directory> [options]
+//   graph_layout_cli --self-test   run the engine's checks, which assert, and exit
+//     -o <directory>       write results there instead of overwriting the inputs
+//     -j <threads>         number of worker threads, default one per hardware thread
+//     --spacing <x>,<y>    spacing between nodes and layers
+//     --max-iterations <n> ordering iterations
+//     --stable             keep the order of the current positions, for graphs arranged before
+//     --sifting <sweeps>   move every node through its layer after the barycenter sweeps, to cross fewer edges
+//     --hub-degree <n>     order without nodes of more edges than this, then put them where they cross the least
+//     --crossing-samples <n> compare sweeps on this many sampled edge pairs per wide layer pair
+//     --multilevel <nodes> lay out graphs larger than this through coarser copies of them
+//     --bundle-edges       long edges leaving one pin share their dummy nodes until they part
+//     --greedy-acyclic     break cycles by a weighted greedy feedback arc set instead of a depth first search
+//     --tree-layout        lay out trees by a linear time tidy tree pass instead of the layered pipeline
+//     --rank-pivots <n>    rank by longest path and at most this many network simplex pivots
+//     --rank-budget <ms>   stop network simplex after this long, alone or with --rank-pivots
+//     --vertical           vertical layout
+//     --horizontal         horizontal layout
+//     --report <file>      per graph CSV report
+//     --cache <entries>    reuse layouts of identical graphs and sub graphs, shared by all threads
+//     --cache-file <path>  keep reused layouts on disk across runs, implies --cache 256
+//     --dry-run            arrange without writing results
+//
+// Binary graph files (.glgf) get their positions written back in place, DOT and JSON graphs
+// are written as .glgf files with results next to the input or into the output directory.
+
+#include "graph_layout/graph_file.h"
+#include "graph_layout/graph_import.h"
+#include "graph_layout/layout_cache.h"
+#include "graph_layout/layout_store.h"
+#include "graph_layout/thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace graph_layout;
+namespace fs = std::filesystem;
+
+struct cli_options_t
+{
+    fs::path input;
+    fs::path output;
+    size_t thread_count = 0;
+    bool has_spacing = false;
+    vector2_t spacing;
+    int max_iterations = -1;
+    bool is_stable_ordering = false;
+    size_t sifting_iterations = 0;
+    size_t hub_degree = 0;
+    size_t crossing_sample_size = 0;
+    size_t multilevel_threshold = 0;
+    bool is_edge_bundling_enabled = false;
+    bool is_greedy_acyclic = false;
+    bool is_tree_layout_enabled = false;
+    bool is_bounded_ranking = false;
+    size_t max_rank_pivots = numeric_limits<size_t>::max();
+    float rank_time_budget_ms = numeric_limits<float>::max();
+    int is_vertical_layout = -1;
+    string report;
+    size_t cache_entries = 0;
+    string cache_file;
+    bool dry_run = false;
+    bool self_test = false;
+};
+
+struct file_result_t
+{
+    bool ok = false;
+    size_t nodes = 0;
+    size_t edges = 0;
+    double load_ms = 0;
+    double arrange_ms = 0;
+    // Weight of the edges inverted to break cycles and dummy nodes added, over every laid out graph.
+    size_t inverted_weight = 0;
+    size_t dummy_nodes = 0;
+    // Time spent ranking and the sum of the edge lengths it ended with.
+    double rank_ms = 0;
+    size_t edge_length = 0;
+    string error;
+};
+
+// Per worker state reused by every graph the worker processes.
+struct worker_arena_t
+{
+    vector<uint8_t> buffer;
+    // Components of a graph are arranged on the pool too, which helps when one big graph is left at the end.
+    thread_pool_t* thread_pool = nullptr;
+    layout_cache_t* layout_cache = nullptr;
+};
+
+static double elapsed_ms(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+static void apply_settings(graph_t* graph, const cli_options_t& options)
+{
+    if (options.has_spacing)
+    {
+        graph->spacing = options.spacing;
+    }
+    if (options.is_vertical_layout >= 0)
+    {
+        graph->is_vertical_layout = options.is_vertical_layout != 0;
+    }
+    if (auto disconnected = dynamic_cast<disconnected_graph_t*>(graph))
+    {
+        for (auto child : disconnected->get_connected_graphs())
+        {
+            apply_settings(child, options);
+        }
+        return;
+    }
+    if (auto connected = dynamic_cast<connected_graph_t*>(graph))
+    {
+        if (options.max_iterations >= 0)
+        {
+            connected->max_iterations = options.max_iterations;
+        }
+        connected->is_stable_ordering = options.is_stable_ordering;
+        connected->is_sifting_enabled = options.sifting_iterations > 0;
+        connected->sifting_iterations = options.sifting_iterations;
+        connected->hub_degree = options.hub_degree;
+        connected->crossing_sample_size = options.crossing_sample_size;
+        connected->multilevel_threshold = options.multilevel_threshold;
+        connected->is_edge_bundling_enabled = options.is_edge_bundling_enabled;
+        connected->acyclic_mode = options.is_greedy_acyclic ? acyclic_mode_t::greedy : acyclic_mode_t::depth_first;
+        connected->is_tree_layout_enabled = options.is_tree_layout_enabled;
+        connected->is_bounded_ranking = options.is_bounded_ranking;
+        connected->max_rank_pivots = options.max_rank_pivots;
+        connected->rank_time_budget_ms = options.rank_time_budget_ms;
+    }
+    for (auto node : graph->nodes)
+    {
+        if (node->graph)
+        {
+            apply_settings(node->graph, options);
+        }
+    }
+}
+
+static void collect_layout_stats(const graph_t* graph, file_result_t& result)
+{
+    if (auto disconnected = dynamic_cast<const disconnected_graph_t*>(graph))
+    {
+        for (auto child : disconnected->get_connected_graphs())
+        {
+            collect_layout_stats(child, result);
+        }
+        return;
+    }
+    if (auto connected = dynamic_cast<const connected_graph_t*>(graph))
+    {
+        result.inverted_weight += connected->acyclic_stats.inverted_weight;
+        result.rank_ms += connected->rank_stats.elapsed_ms;
+        result.edge_length += connected->rank_stats.total_length;
+    }
+    for (auto node : graph->nodes)
+    {
+        if (node->is_dummy_node)
+        {
+            result.dummy_nodes++;
+        }
+        else if (node->graph)
+        {
+            collect_layout_stats(node->graph, result);
+        }
+    }
+}
+
+static bool read_file(const fs::path& path, vector<uint8_t>& buffer)
+{
+    ifstream stream(path, ios::binary | ios::ate);
+    if (!stream)
+    {
+        return false;
+    }
+    const auto size = static_cast<size_t>(stream.tellg());
+    buffer.resize(size);
+    stream.seekg(0);
+    return static_cast<bool>(stream.read(reinterpret_cast<char*>(buffer.data()), size));
+}
+
+static bool write_file(const fs::path& path, const uint8_t* data, size_t size)
+{
+    ofstream stream(path, ios::binary | ios::trunc);
+    return stream && stream.write(reinterpret_cast<const char*>(data), size);
+}
+
+static bool is_binary_graph(const fs::path& path)
+{
+    return path.extension() == ".glgf";
+}
+
+static bool is_graph_file(const fs::path& path)
+{
+    const auto extension = path.extension();
+    return extension == ".glgf" || extension == ".dot" || extension == ".gv" || extension == ".json";
+}
+
+static fs::path output_path(const fs::path& file, const cli_options_t& options)
+{
+    fs::path path = options.output.empty() ? file : options.output / fs::relative(file, options.input);
+    if (!is_binary_graph(file))
+    {
+        path.replace_extension(".glgf");
+    }
+    return path;
+}
+
+static file_result_t process_file(const fs::path& file, const cli_options_t& options, worker_arena_t& arena)
+{
+    file_result_t result;
+    auto start = chrono::steady_clock::now();
+    bool loaded;
+    if (is_binary_graph(file))
+    {
+        loaded = read_file(file, arena.buffer);
+    }
+    else
+    {
+        // Text graphs go through the binary format too, results are stored by record and
+        // serializing the arranged graph would drop edges replaced by dummy nodes.
+        graph_t* imported = import_graph_file(file.string(), {}, &result.error);
+        loaded = imported != nullptr;
+        if (imported)
+        {
+            arena.buffer = serialize_graph(imported);
+            delete imported;
+        }
+    }
+    graph_file_index_t index;
+    graph_file_view_t view;
+    graph_t* graph = loaded && view.open(arena.buffer.data(), arena.buffer.size()) ? view.load(&index) : nullptr;
+    if (!graph)
+    {
+        if (result.error.empty())
+        {
+            result.error = "invalid graph file";
+        }
+        return result;
+    }
+    result.load_ms = elapsed_ms(start);
+    result.nodes = index.nodes.size();
+    result.edges = view.header->edge_count;
+    apply_settings(graph, options);
+    graph->thread_pool = arena.thread_pool;
+    graph->layout_cache = arena.layout_cache;
+
+    start = chrono::steady_clock::now();
+    graph->arrange();
+    result.arrange_ms = elapsed_ms(start);
+    collect_layout_stats(graph, result);
+
+    result.ok = true;
+    if (!options.dry_run)
+    {
+        const fs::path path = output_path(file, options);
+        error_code ec;
+        fs::create_directories(path.parent_path(), ec);
+        result.ok = store_results(index, arena.buffer.data(), arena.buffer.size()) && write_file(path, arena.buffer.data(), arena.buffer.size());
+        if (!result.ok)
+        {
+            result.error = "can't write " + path.string();
+        }
+    }
+    delete graph;
+    return result;
+}
+
+static bool parse_arguments(int argc, char** argv, cli_options_t& options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        const string arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        if (arg == "-o" && has_value)
+        {
+            options.output = argv[++i];
+        }
+        else if (arg == "-j" && has_value)
+        {
+            options.thread_count = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--spacing" && has_value)
+        {
+            options.has_spacing = sscanf(argv[++i], "%f,%f", &options.spacing.x, &options.spacing.y) == 2;
+            if (!options.has_spacing)
+            {
+                return false;
+            }
+        }
+        else if (arg == "--max-iterations" && has_value)
+        {
+            options.max_iterations = atoi(argv[++i]);
+        }
+        else if (arg == "--vertical")
+        {
+            options.is_vertical_layout = 1;
+        }
+        else if (arg == "--horizontal")
+        {
+            options.is_vertical_layout = 0;
+        }
+        else if (arg == "--report" && has_value)
+        {
+            options.report = argv[++i];
+        }
+        else if (arg == "--cache" && has_value)
+        {
+            options.cache_entries = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--cache-file" && has_value)
+        {
+            options.cache_file = argv[++i];
+        }
+        else if (arg == "--stable")
+        {
+            options.is_stable_ordering = true;
+        }
+        else if (arg == "--sifting" && has_value)
+        {
+            options.sifting_iterations = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--hub-degree" && has_value)
+        {
+            options.hub_degree = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--crossing-samples" && has_value)
+        {
+            options.crossing_sample_size = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--multilevel" && has_value)
+        {
+            options.multilevel_threshold = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--bundle-edges")
+        {
+            options.is_edge_bundling_enabled = true;
+        }
+        else if (arg == "--greedy-acyclic")
+        {
+            options.is_greedy_acyclic = true;
+        }
+        else if (arg == "--tree-layout")
+        {
+            options.is_tree_layout_enabled = true;
+        }
+        else if (arg == "--rank-pivots" && has_value)
+        {
+            options.is_bounded_ranking = true;
+            options.max_rank_pivots = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--rank-budget" && has_value)
+        {
+            options.is_bounded_ranking = true;
+            options.rank_time_budget_ms = strtof(argv[++i], nullptr);
+        }
+        else if (arg == "--dry-run")
+        {
+            options.dry_run = true;
+        }
+        else if (arg == "--self-test")
+        {
+            options.self_test = true;
+        }
+        else if (options.input.empty() && arg[0] != '-')
+        {
+            options.input = arg;
+        }
+        else
+        {
+            return false;
+        }
+    }
+    return !options.input.empty() || options.self_test;
+}
+
+int main(int argc, char** argv)
+{
+    cli_options_t options;
+    if (!parse_arguments(argc, argv, options))
+    {
+        fprintf(stderr, "usage: graph_layout_cli <directory> [-o <directory>] [-j <threads>] [--spacing <x>,<y>] [--max-iterations <n>] [--stable] [--sifting <sweeps>] [--hub-degree <n>] [--crossing-samples <n>] [--multilevel <nodes>] [--bundle-edges] [--greedy-acyclic] [--tree-layout] [--rank-pivots <n>] [--rank-budget <ms>] [--vertical|--horizontal] [--report <file>] [--cache <entries>] [--cache-file <path>] [--dry-run]\n       graph_layout_cli --self-test\n");
+        return 2;
+    }
+    if (options.self_test)
+    {
+        connected_graph_t::test();
+        printf("self test passed\n");
+        return 0;
+    }
+
+    vector<fs::path> files;
+    error_code ec;
+    for (fs::recursive_directory_iterator it(options.input, ec), end; !ec && it != end; it.increment(ec))
+    {
+        if (it->is_regular_file() && is_graph_file(it->path()))
+        {
+            files.push_back(it->path());
+        }
+    }
+    if (ec)
+    {
+        fprintf(stderr, "can't read %s\n", options.input.string().c_str());
+        return 1;
+    }
+    // Largest files first, so a big graph picked up last doesn't leave the other threads idle.
+    vector<uintmax_t> sizes(files.size());
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        sizes[i] = fs::file_size(files[i], ec);
+    }
+    vector<size_t> order(files.size());
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        order[i] = i;
+    }
+    stable_sort(order.begin(), order.end(), [&sizes](size_t a, size_t b) { return sizes[a] > sizes[b]; });
+
+    vector<file_result_t> results(files.size());
+    layout_store_t layout_store;
+    if (!options.cache_file.empty())
+    {
+        if (!layout_store.open(options.cache_file))
+        {
+            fprintf(stderr, "can't open %s\n", options.cache_file.c_str());
+            return 1;
+        }
+        if (options.cache_entries == 0)
+        {
+            options.cache_entries = 256;
+        }
+    }
+    unique_ptr<layout_cache_t> layout_cache;
+    if (options.cache_entries > 0)
+    {
+        layout_cache = make_unique<layout_cache_t>(options.cache_entries, layout_store.is_open() ? &layout_store : nullptr);
+    }
+    const auto start = chrono::steady_clock::now();
+    {
+        thread_pool_t pool(options.thread_count);
+        atomic<size_t> next{0};
+        for (size_t t = 0; t < pool.size(); t++)
+        {
+            pool.run([&]()
+            {
+                worker_arena_t arena;
+                arena.thread_pool = &pool;
+                arena.layout_cache = layout_cache.get();
+                for (size_t i = next++; i < order.size(); i = next++)
+                {
+                    results[order[i]] = process_file(files[order[i]], options, arena);
+                }
+            });
+        }
+        pool.wait();
+        options.thread_count = pool.size();
+    }
+    const double seconds = elapsed_ms(start) / 1000;
+
+    size_t failed = 0, nodes = 0, edges = 0;
+    double arrange_ms = 0;
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        const auto& result = results[i];
+        if (!result.ok)
+        {
+            failed++;
+            fprintf(stderr, "%s: %s\n", files[i].string().c_str(), result.error.c_str());
+        }
+        nodes += result.nodes;
+        edges += result.edges;
+        arrange_ms += result.arrange_ms;
+    }
+    if (!options.report.empty())
+    {
+        if (FILE* report = fopen(options.report.c_str(), "w"))
+        {
+            fprintf(report, "file,ok,nodes,edges,load_ms,arrange_ms,inverted_weight,dummy_nodes,rank_ms,edge_length\n");
+            for (size_t i = 0; i < files.size(); i++)
+            {
+                const auto& result = results[i];
+                fprintf(report, "\"%s\",%d,%zu,%zu,%.3f,%.3f,%zu,%zu,%.3f,%zu\n", files[i].string().c_str(), result.ok ? 1 : 0, result.nodes, result.edges, result.load_ms, result.arrange_ms,
+                        result.inverted_weight, result.dummy_nodes, result.rank_ms, result.edge_length);
+            }
+            fclose(report);
+        }
+        else
+        {
+            fprintf(stderr, "can't write %s\n", options.report.c_str());
+        }
+    }
+    printf("%zu graphs (%zu failed), %zu nodes, %zu edges, %zu threads\n", files.size(), failed, nodes, edges, options.thread_count);
+    printf("%.3f s, %.1f graphs/s, %.3f s arranging in total\n", seconds, seconds > 0 ? files.size() / seconds : 0.0, arrange_ms / 1000);
+    if (layout_cache)
+    {
+        printf("layout cache: %zu hits, %zu misses\n", layout_cache->hits(), layout_cache->misses());
+    }
+    if (layout_store.is_open())
+    {
+        layout_store.flush();
+        printf("layout store: %llu bytes\n", static_cast<unsigned long long>(layout_store.size_in_bytes()));
+    }
+    return failed == 0 ? 0 : 1;
+}